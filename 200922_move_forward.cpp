@@ -17,14 +17,16 @@ forward(typename std::remove_reference<T>::type& param)
     return static_cast<T&&>(param);
 }
 
+#include "trace.h"
+
 class A
 {
 public:
     A() {}
-    A(const A& rhs) { puts("A(const A&)"); }
-    A(A&& rhs) { puts("A(A&&)"); }
-    A& operator=(const A& rhs) { puts("A& operator=(const A&)"); return *this; }
-    A& operator=(A&& rhs) { puts("A& operator=(A&&)"); return *this; }
+    A(const A& rhs) { default_trace::record("A(const A&)"); }
+    A(A&& rhs) { default_trace::record("A(A&&)"); }
+    A& operator=(const A& rhs) { default_trace::record("A& operator=(const A&)"); return *this; }
+    A& operator=(A&& rhs) { default_trace::record("A& operator=(A&&)"); return *this; }
 
     void swapCopy(A& rhs)
     {
@@ -63,6 +65,7 @@ int main()
     // perfect forwarding
     w.setA(a);
     w.setA(A());
+    default_trace::dump();
     // A& operator=(const A&)
     // A& operator=(A&&)
 
@@ -70,6 +73,7 @@ int main()
     A a1, a2;
     a1.swapCopy(a2);
     a1.swapMove(a2);
+    default_trace::dump();
     // A(const A&)
     // A& operator=(const A&)
     // A& operator=(const A&)
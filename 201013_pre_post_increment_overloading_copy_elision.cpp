@@ -1,4 +1,5 @@
 #include <cstdio>
+#include "trace.h"
 
 template <typename T>
 struct type_identity { using type = T; };
@@ -20,12 +21,12 @@ remove_reference_t<T>&& move(T&& param)
 }
 
 struct S {
-    explicit S(int _data) : data(_data) { puts("explicit S(int)"); }
+    explicit S(int _data) : data(_data) { default_trace::record("explicit S(int)"); }
 
-    ~S() { puts("~S()"); }
+    ~S() { default_trace::record("~S()"); }
  
-    S(const S&  rhs) : data(rhs.data) { puts("S(const S& rhs)"); }
-    S(      S&& rhs) : data(rhs.data) { puts("S(S&&)"); }
+    S(const S&  rhs) : data(rhs.data) { default_trace::record("S(const S& rhs)"); }
+    S(      S&& rhs) : data(rhs.data) { default_trace::record("S(S&&)"); }
 
     S& operator++()    { ++data; return *this; }
     S  operator++(int) { S ret(data); ++data; return ret; }
@@ -39,6 +40,7 @@ void testS()
         S s(0);
         S s1(s);
         S s2(move(s1));
+        default_trace::dump();
 
         // explicit S(int) // S s(0)
         // S(const S& rhs) // S s1(s)
@@ -53,6 +55,7 @@ void testS()
     S s2(move(++s1));
     S s3(s2++);
     S s4(move(s3++));
+    default_trace::dump();
     printf("s : %d\n", s.data);
     printf("s1: %d\n", s1.data);
     printf("s2: %d\n", s2.data);
@@ -83,7 +86,7 @@ struct T {
         : data(new int)
     {
         *data = value;
-        puts("explicit T(int)");
+        default_trace::record("explicit T(int)");
     }
 
     ~T()
@@ -92,21 +95,21 @@ struct T {
         {
             delete data;
         }
-        puts("~T()");
+        default_trace::record("~T()");
     }
  
     T(const T& rhs)
     {
         data = new int;
         *data = *(rhs.data);
-        puts("T(const T& rhs)");
+        default_trace::record("T(const T& rhs)");
     }
  
     T(T&& rhs)
     {
         data = rhs.data;
         rhs.data = nullptr;
-        puts("T(T&&)");
+        default_trace::record("T(T&&)");
     }
 
     T& operator++()
@@ -131,6 +134,7 @@ void testT()
         T t(0);
         T t1(t);
         T t2(move(t));
+        default_trace::dump();
 
         // explicit T(int) // T t(0)
         // T(const T& rhs) // T t1(t)
@@ -145,6 +149,7 @@ void testT()
     T t2(move(++t1));
     T t3(t2++);
     T t4(move(t3++));
+    default_trace::dump();
     printf("t : %d\n", *(t.data));
     // printf("t1: %d\n", *(t1.data)); // we cannot access t1
     printf("t2: %d\n", *(t2.data));
@@ -169,8 +174,28 @@ void testT()
     // ~T()
 }
 
+#include "benchmark.h"
+
+// with -DBENCHMARK_COUNT_ALLOCATIONS: what each of the operations above costs on the heap
+void testAllocations()
+{
+    S s(0);
+    report_allocations("S s1(s)", [&] { S s1(s); });
+    report_allocations("s++", [&] { s++; });
+
+    T t(0);
+    report_allocations("T t1(t)", [&] { T t1(t); });
+    report_allocations("++t", [&] { ++t; });
+    report_allocations("t++", [&] { t++; });                // the copy it returns
+    report_allocations("T t2(move(t))", [&] { T t2(move(t)); });
+}
+
 int main()
 {
     testS();
+    default_trace::dump();
     testT();
+    default_trace::dump();
+    testAllocations();
+    default_trace::dump();
 }
\ No newline at end of file
@@ -4,7 +4,63 @@
 // part 1 of 2
 // Back to Basics: Templates (part 1 of 2) - Andreas Fertig - CppCon 2020
 
-template <typename T, size_t N>
+#include <cassert>
+#include <stdexcept>
+
+// Bounds-check policies for operator[] of Array and Span: index() is called for every access,
+// range() once for a whole view (Span::first, last, subspan), so that a loop over the view checks nothing.
+// - unchecked: nothing at all
+// - assert_bounds: assert(), so nothing at all with -DNDEBUG
+// - trap_bounds: a branch to an illegal instruction; cheap, but an early exit out of the loop
+// - log_bounds: printf() and carry on, as Array always did
+// at() checks whatever the policy, and throws std::out_of_range.
+// Codegen (g++ 12 -O3 -fopt-info-vec), `for (size_t i = 0; i < n; ++i) sum += arr[i];` with a run-time n:
+// unchecked is always "loop vectorized using 16 byte vectors". With a check, it depends on whether the optimizer
+// manages to cut the loop in two at i == N (-fsplit-loops) and vectorize the part before. In bounds_check_benchmark
+// it does for assert_bounds and trap_bounds, but not for log_bounds, whose loop stays scalar (about 4x slower);
+// in a function on its own, with n from a parameter, only unchecked and assert_bounds with -DNDEBUG are vectorized.
+// `for (int x : Span(arr).first(n)) sum += x;` checks once in first() and is vectorized with every policy, always.
+struct unchecked {
+    static constexpr void index(size_t, size_t) {}
+    static constexpr void range(size_t, size_t, size_t) {}
+};
+
+struct assert_bounds {
+    static constexpr void index(size_t idx, size_t size) { assert(idx < size); }
+    static constexpr void range(size_t offset, size_t count, size_t size) { assert(offset <= size && count <= size - offset); }
+};
+
+struct trap_bounds {
+    static constexpr void index(size_t idx, size_t size) { if (idx >= size) __builtin_trap(); }
+    static constexpr void range(size_t offset, size_t count, size_t size) { if (offset > size || count > size - offset) __builtin_trap(); }
+};
+
+struct log_bounds {
+    static void index(size_t idx, size_t size)
+    {
+        if (idx >= size)
+            printf("index value(%zu) is out of bounds of this array of %zu elements\n", idx, size);
+    }
+    static void range(size_t offset, size_t count, size_t size)
+    {
+        if (offset > size || count > size - offset)
+            printf("range [%zu, %zu) is out of bounds of this array of %zu elements\n", offset, offset + count, size);
+    }
+};
+
+#ifdef NDEBUG
+using default_bounds_check = unchecked;
+#else
+using default_bounds_check = log_bounds;
+#endif
+
+inline void check_at(size_t idx, size_t size)
+{
+    if (idx >= size)
+        throw std::out_of_range("index out of bounds");
+}
+
+template <typename T, size_t N, typename Check = default_bounds_check>
 class Array
 {
 public:
@@ -12,14 +68,24 @@ public:
     T* end() { return m_data + N; };
     const T* cbegin() const { return m_data; };
     const T* cend() const { return m_data + N; };
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+    constexpr size_t size() const { return N; }
  
     T& operator[](size_t idx)
     {
-        if (idx >= N)
-            printf("index value(%llu) is out of bounds of this array of %llu elements\n", idx, N);
+        Check::index(idx, N);
+        return m_data[idx];
+    }
+    const T& operator[](size_t idx) const
+    {
+        Check::index(idx, N);
         return m_data[idx];
     }
 
+    T& at(size_t idx)               { check_at(idx, N); return m_data[idx]; }
+    const T& at(size_t idx) const   { check_at(idx, N); return m_data[idx]; }
+
     T m_data[N]; // same as vc++ std::array, note that it is public so we can construct the class with std::initializer_list
 };
 
@@ -39,32 +105,138 @@ void array_test()
     printf("\n");
 }
 
-template <typename T>
-class Span
+#include <concepts>
+#include <type_traits>
+#include <vector>
+
+// A Span is a view: a pointer to elements that live somewhere else, and how many of them there are.
+// It allocates and copies nothing, and writing through it writes the elements it looks at.
+// When the number of elements is known at compile time (Extent), the Span is just the pointer.
+inline constexpr size_t dynamic_extent = static_cast<size_t>(-1);
+
+template <size_t Extent>
+struct span_extent
+{
+    constexpr explicit span_extent(size_t) {}
+    constexpr size_t size() const { return Extent; }
+};
+
+template <>
+struct span_extent<dynamic_extent>
+{
+    constexpr explicit span_extent(size_t _size) : m_size(_size) {}
+    constexpr size_t size() const { return m_size; }
+
+    size_t m_size;
+};
+
+// Check: see Array
+template <typename T, size_t Extent = dynamic_extent, typename Check = default_bounds_check>
+class Span : private span_extent<Extent> // an empty base for a static extent
 {
 public:
-    template <size_t N>
-    explicit Span(T (&_caar)[N])
-        : m_data(new T[N]), m_size(N) { std::copy(_caar, _caar + N, m_data); }
+    constexpr Span(T* _data, size_t _size)
+        : span_extent<Extent>(_size), m_data(_data) {}
 
     template <size_t N>
-    explicit Span(Array<T, N> _arr)
-        : m_data(new T[N]), m_size(N) { std::copy(_arr.cbegin(), _arr.cend(), m_data); }
+        requires (Extent == dynamic_extent || Extent == N)
+    constexpr Span(T (&_carr)[N])
+        : span_extent<Extent>(N), m_data(_carr) {}
+
+    // by reference: the Span looks at the elements of this very Array
+    template <typename U, size_t N, typename C>
+        requires (Extent == dynamic_extent || Extent == N) && std::is_convertible_v<U(*)[], T(*)[]>
+    constexpr Span(Array<U, N, C>& _arr)
+        : span_extent<Extent>(N), m_data(_arr.m_data) {}
+
+    template <typename U, size_t N, typename C>
+        requires (Extent == dynamic_extent || Extent == N) && std::is_convertible_v<const U(*)[], T(*)[]>
+    constexpr Span(const Array<U, N, C>& _arr)
+        : span_extent<Extent>(N), m_data(_arr.m_data) {}
+
+    // any container that keeps its elements contiguously: std::vector, std::string, std::array...
+    // Only an lvalue, a temporary would be gone before the Span is used.
+    template <typename Container>
+        requires requires(Container& c) { { c.data() } -> std::convertible_to<T*>; c.size(); }
+    constexpr explicit(Extent != dynamic_extent) Span(Container& _container)
+        : span_extent<Extent>(_container.size()), m_data(_container.data()) {}
+
+    // a Span<T, N> is a Span<T> as well, a Span<int> is a Span<const int>
+    template <typename U, size_t N, typename C>
+        requires (Extent == dynamic_extent || Extent == N) && std::is_convertible_v<U(*)[], T(*)[]>
+    constexpr Span(const Span<U, N, C>& _other)
+        : span_extent<Extent>(_other.size()), m_data(_other.data()) {}
+
+    constexpr T* begin() const { return m_data; }
+    constexpr T* end() const { return m_data + size(); }
+    constexpr T* data() const { return m_data; }
+    constexpr size_t size() const { return span_extent<Extent>::size(); }
+    constexpr bool empty() const { return size() == 0; }
+
+    constexpr T& operator[](size_t idx) const
+    {
+        Check::index(idx, size());
+        return m_data[idx];
+    }
 
-    ~Span() { if (m_data) delete[] m_data; }
+    constexpr T& at(size_t idx) const   { check_at(idx, size()); return m_data[idx]; }
 
-    T* begin() { return m_data; };
-    T* end() { return m_data + m_size; };
-    T& operator[] (size_t idx)
+    // the first or last Count elements, or the Count elements from Offset on, as views again.
+    // A Count known at compile time gives a Span of static extent.
+    // The range is checked here, once, rather than at every element of a loop over the view.
+    template <size_t Count>
+    constexpr Span<T, Count, Check> first() const { Check::range(0, Count, size()); return {m_data, Count}; }
+    constexpr Span<T, dynamic_extent, Check> first(size_t _count) const { Check::range(0, _count, size()); return {m_data, _count}; }
+
+    template <size_t Count>
+    constexpr Span<T, Count, Check> last() const { Check::range(size() - Count, Count, size()); return {m_data + size() - Count, Count}; }
+    constexpr Span<T, dynamic_extent, Check> last(size_t _count) const { Check::range(size() - _count, _count, size()); return {m_data + size() - _count, _count}; }
+
+    template <size_t Offset, size_t Count = dynamic_extent>
+    constexpr auto subspan() const
     {
-        return m_data[idx];
+        if constexpr (Count != dynamic_extent)
+        {
+            Check::range(Offset, Count, size());
+            return Span<T, Count, Check>(m_data + Offset, Count);
+        }
+        else if constexpr (Extent != dynamic_extent)
+        {
+            static_assert(Offset <= Extent);
+            return Span<T, Extent - Offset, Check>(m_data + Offset, Extent - Offset);
+        }
+        else
+        {
+            Check::range(Offset, 0, size());
+            return Span<T, dynamic_extent, Check>(m_data + Offset, size() - Offset);
+        }
+    }
+    constexpr Span<T, dynamic_extent, Check> subspan(size_t _offset, size_t _count = dynamic_extent) const
+    {
+        Check::range(_offset, _count == dynamic_extent ? 0 : _count, size());
+        return {m_data + _offset, _count == dynamic_extent ? size() - _offset : _count};
     }
 
 private:
     T* m_data;
-    size_t m_size;
 };
 
+// deduction guides: an array of N elements gives a Span of extent N, a container a Span of dynamic extent
+template <typename T, size_t N>
+Span(T (&)[N]) -> Span<T, N>;
+
+template <typename T, size_t N, typename C>
+Span(Array<T, N, C>&) -> Span<T, N, C>;
+
+template <typename T, size_t N, typename C>
+Span(const Array<T, N, C>&) -> Span<const T, N, C>;
+
+template <typename Container>
+Span(Container&) -> Span<std::remove_pointer_t<decltype(std::declval<Container&>().data())>>;
+
+static_assert(sizeof(Span<int, 5>) == sizeof(int*));
+static_assert(sizeof(Span<int>) == sizeof(int*) + sizeof(size_t));
+
 void span_test()
 {
     int arr1[5]{1, 2, 3, 4, 1};
@@ -89,6 +261,459 @@ void span_test()
     for (const auto i : si2)
         printf("%d", i);
     printf("\n");
+
+    // the Spans wrote to the arrays themselves
+    printf("%d%d %d%d\n", arr1[0], arr1[1], arr2[0], arr2[1]);
+
+    // deduced from an array: the extent is part of the type, and the Span is only a pointer
+    Span si3{arr2};
+    static_assert(sizeof(si3) == sizeof(int*));
+
+    for (const auto i : si3.first<2>())
+        printf("%d", i);
+    printf(" ");
+    for (const auto i : si3.last(2))
+        printf("%d", i);
+    printf(" ");
+    for (const auto i : si3.subspan<1, 3>())
+        printf("%d", i);
+    printf("\n");
+
+    std::vector<int> vec{6, 7, 8};
+    Span<const int> si4{vec};
+    for (const auto i : si4.subspan(1))
+        printf("%d", i);
+    printf("\n");
+}
+
+#include "benchmark.h"
+
+// with -DBENCHMARK_COUNT_ALLOCATIONS: a Span allocates nothing, whatever it is made from
+void span_allocation_test()
+{
+    int arr1[5]{1, 2, 3, 4, 1};
+    Array<int, 5> arr2{1, 2, 3, 4, 2};
+    std::vector<int> vec{1, 2, 3, 4, 3};
+
+    report_allocations("Span<int> si1{arr1}", [&] { Span<int> si1{arr1}; do_not_optimize(si1.data()); });
+    report_allocations("Span<int> si2{arr2}", [&] { Span<int> si2{arr2}; do_not_optimize(si2.data()); });
+    report_allocations("Span<int> si3{vec}", [&] { Span<int> si3{vec}; do_not_optimize(si3.data()); });
+}
+
+// Throughput of a sum over 16384 ints (64 KiB), indexed or over a checked view, with every policy.
+// Build with -O3 and with and without -DNDEBUG to see the codegen above at work.
+template <typename Check>
+void bounds_check_benchmark(benchmark_suite& suite, const char* name)
+{
+    static Array<int, 16384, Check> arr{};
+    size_t n = arr.size();
+    do_not_optimize(n); // a run-time bound, like most loops have
+
+    char row[64];
+    snprintf(row, sizeof(row), "%s arr[i]", name);
+    suite.run(row, [&] {
+        int sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += arr[i];
+        do_not_optimize(sum);
+    });
+
+    snprintf(row, sizeof(row), "%s Span(arr).first(n)", name);
+    suite.run(row, [&] {
+        int sum = 0;
+        for (int x : Span(arr).first(n))
+            sum += x;
+        do_not_optimize(sum);
+    });
+}
+
+void bounds_check_test()
+{
+    Array<int, 5, trap_bounds> ai{0, 1, 2, 3, 4};
+    try
+    {
+        ai.at(5) = 5;
+    }
+    catch (const std::out_of_range& e)
+    {
+        printf("at(5): %s\n", e.what());
+    }
+
+    benchmark_suite suite("bounds_check_test (16384 ints, ns per sum)");
+    bounds_check_benchmark<unchecked>(suite, "unchecked");
+    bounds_check_benchmark<assert_bounds>(suite, "assert_bounds");
+    bounds_check_benchmark<trap_bounds>(suite, "trap_bounds");
+    bounds_check_benchmark<log_bounds>(suite, "log_bounds");
+}
+
+#include "simd.h"
+
+// sum/min/max/dot/transform over 16K elements with every instruction set this machine has, in elements per ns.
+// 16K elements stay in the L2 cache, so the kernels run as fast as they can compute. Over millions of elements,
+// memory bandwidth caps everything above SSE2 at about the same speed (5 floats/ns for a sum here).
+// The scalar loops are compiled like the rest of the program, so at -O3 the compiler vectorizes some of them
+// itself, for the baseline instruction set (SSE2 on x86-64).
+// The transform lambda is instantiated for AVX vectors in a file compiled for SSE2: GCC warns that passing them
+// would change the ABI, but the call is inlined into the AVX kernel and nothing is passed at all (see simd.h).
+// GCC reports it at the lambda, so it is silenced here, around the code that defines it, and at the end of the file.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+template <typename T>
+void simd_benchmark(benchmark_suite& suite, const char* type)
+{
+    constexpr size_t n = 1 << 14;
+    static Array<T, n> a, b, out;
+    // small enough that the sum (24576) and the dot product (16384) fit in a short, so the check below compares
+    // the true results rather than wrapped ones
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = static_cast<T>(i % 4);
+        b[i] = static_cast<T>(i % 2);
+    }
+    Span<const T> in{a};
+
+    // a float sum depends on the order of the additions, the other results do not
+    const T expected_sum = simd::sum(in, simd::isa::scalar);
+    const T expected_dot = simd::dot(in, Span<const T>{b}, simd::isa::scalar);
+    const T expected_max = simd::max(in, simd::isa::scalar);
+    auto agrees = [&](simd::isa level) {
+        return simd::max(in, level) == expected_max
+            && (std::is_floating_point_v<T> || (simd::sum(in, level) == expected_sum && simd::dot(in, Span<const T>{b}, level) == expected_dot));
+    };
+
+    for (simd::isa level : {simd::isa::scalar, simd::isa::sse2, simd::isa::avx2, simd::isa::avx512})
+    {
+        if (level > simd::native_isa())
+            break;
+        if (not agrees(level))
+            printf("%s: %s results differ from the scalar ones\n", type, simd::isa_name(level));
+
+        char row[64];
+        auto name = [&](const char* kernel) { snprintf(row, sizeof(row), "%s<%s> %s", kernel, type, simd::isa_name(level)); return row; };
+
+        const double sum_ns = suite.run(name("sum"), [&] { do_not_optimize(simd::sum(in, level)); }).ns_per_op;
+        const double min_ns = suite.run(name("min"), [&] { do_not_optimize(simd::min(in, level)); }).ns_per_op;
+        const double max_ns = suite.run(name("max"), [&] { do_not_optimize(simd::max(in, level)); }).ns_per_op;
+        const double dot_ns = suite.run(name("dot"), [&] { do_not_optimize(simd::dot(in, Span<const T>{b}, level)); }).ns_per_op;
+        const double transform_ns = suite.run(name("transform"), [&] {
+            simd::transform(in, Span<T>{out}, [](const auto& x) { return x * 3 + 1; }, level);
+            do_not_optimize(out.data());
+        }).ns_per_op;
+        printf("  %s<%s>: %.2f sum, %.2f min, %.2f max, %.2f dot, %.2f transform elements/ns\n", simd::isa_name(level), type,
+               n / sum_ns, n / min_ns, n / max_ns, n / dot_ns, n / transform_ns);
+    }
+}
+#pragma GCC diagnostic pop
+
+void simd_test()
+{
+    printf("native instruction set: %s\n", simd::isa_name(simd::native_isa()));
+
+    benchmark_suite suite("simd_test (16K elements, ns per pass)", 9);
+    simd_benchmark<float>(suite, "float");
+    simd_benchmark<int>(suite, "int");
+    simd_benchmark<short>(suite, "short");
+}
+
+#include <initializer_list>
+#include <tuple>
+
+// Structure of arrays: soa_array<Record, N> and soa_vector<Record> keep each member of Record in a column of its own,
+// so that a pass over one member reads that member only, where Array<Record, N> drags the whole record through
+// the cache for it. column<I>() is a Span over the I-th member of every row, for simd::sum and the like;
+// soa[i] is a row, a proxy with a reference to each of its members (see soa_row).
+// The columns are derived from Record, which must be an aggregate of 1 to 8 members, none of them an array or
+// an aggregate itself: the members are counted by how many initializers Record{...} takes, and bound by a
+// structured binding, in declaration order.
+namespace soa_detail {
+    // converts to anything, to stand in for any member in Record{...}
+    struct any_field {
+        template <typename T> constexpr operator T() const;
+    };
+
+    template <typename Record, typename... Fields>
+    constexpr size_t field_count()
+    {
+        if constexpr (requires { Record{Fields{}..., any_field{}}; })
+            return field_count<Record, Fields..., any_field>();
+        else
+            return sizeof...(Fields);
+    }
+
+    // the members of _record, as a tuple of references
+    template <typename Record>
+    constexpr auto tie(Record& _record)
+    {
+        constexpr size_t n = field_count<std::remove_const_t<Record>>();
+        static_assert(std::is_aggregate_v<std::remove_const_t<Record>> && n >= 1 && n <= 8,
+                      "soa: Record must be an aggregate of 1 to 8 members");
+
+        auto& r = _record;
+        if constexpr (n == 1) { auto& [a] = r; return std::tie(a); }
+        else if constexpr (n == 2) { auto& [a, b] = r; return std::tie(a, b); }
+        else if constexpr (n == 3) { auto& [a, b, c] = r; return std::tie(a, b, c); }
+        else if constexpr (n == 4) { auto& [a, b, c, d] = r; return std::tie(a, b, c, d); }
+        else if constexpr (n == 5) { auto& [a, b, c, d, e] = r; return std::tie(a, b, c, d, e); }
+        else if constexpr (n == 6) { auto& [a, b, c, d, e, f] = r; return std::tie(a, b, c, d, e, f); }
+        else if constexpr (n == 7) { auto& [a, b, c, d, e, f, g] = r; return std::tie(a, b, c, d, e, f, g); }
+        else { auto& [a, b, c, d, e, f, g, h] = r; return std::tie(a, b, c, d, e, f, g, h); }
+    }
+
+    // Column<F>... for the members F... of Record: columns_t<Record, std::vector> is std::tuple<std::vector<F>...>
+    template <template <typename> class Column, typename Refs>
+    struct columns;
+    template <template <typename> class Column, typename... Fs>
+    struct columns<Column, std::tuple<Fs&...>> { using type = std::tuple<Column<Fs>...>; };
+
+    template <typename Record, template <typename> class Column>
+    using columns_t = typename columns<Column, decltype(tie(std::declval<Record&>()))>::type;
+
+    template <typename F> using pointer = F*;
+    template <typename F> using const_pointer = const F*;
+
+    // the data() of every column
+    template <typename Pointers, typename Columns>
+    constexpr Pointers data(Columns& _columns)
+    {
+        return std::apply([](auto&... c) { return Pointers(c.data()...); }, _columns);
+    }
+}
+
+// A row of a structure of arrays: a pointer to each of its members, wherever their columns are.
+// get<I>() is the I-th member, and so is the I-th name of a structured binding: `auto [x, y] = soa[i]; x = 1;` writes
+// the column. Converting a row to a Record reads every member, assigning a Record (or another row) writes them.
+// Pointers is std::tuple<F*...>, or std::tuple<const F*...> for a row of a const container.
+template <typename Record, typename Pointers>
+class soa_row
+{
+public:
+    constexpr soa_row(const Pointers& _columns, size_t _idx)
+        : m_fields(std::apply([_idx](auto*... c) { return Pointers(c + _idx...); }, _columns)) {}
+
+    template <size_t I>
+    constexpr auto& get() const { return *std::get<I>(m_fields); }
+
+    constexpr operator Record() const
+    {
+        return std::apply([](auto*... f) { return Record{*f...}; }, m_fields);
+    }
+
+    constexpr soa_row& operator=(const Record& _rhs)
+    {
+        assign(soa_detail::tie(_rhs), std::make_index_sequence<std::tuple_size_v<Pointers>>());
+        return *this;
+    }
+
+    // copies the members, as a Record& would, rather than the pointers
+    constexpr soa_row& operator=(const soa_row& _rhs) { return *this = static_cast<Record>(_rhs); }
+
+    constexpr soa_row(const soa_row&) = default;
+
+private:
+    template <typename Refs, size_t... I>
+    constexpr void assign(const Refs& _rhs, std::index_sequence<I...>)
+    {
+        ((*std::get<I>(m_fields) = std::get<I>(_rhs)), ...);
+    }
+
+    Pointers m_fields;
+};
+
+template <typename Record, typename Pointers>
+struct std::tuple_size<soa_row<Record, Pointers>> : std::tuple_size<Pointers> {};
+
+template <size_t I, typename Record, typename Pointers>
+struct std::tuple_element<I, soa_row<Record, Pointers>> { using type = std::remove_pointer_t<std::tuple_element_t<I, Pointers>>&; };
+
+// a row index and the columns it indexes, for range-for over the rows
+template <typename Record, typename Pointers>
+class soa_iterator
+{
+public:
+    constexpr soa_iterator(const Pointers& _columns, size_t _idx) : m_columns(_columns), m_idx(_idx) {}
+
+    constexpr soa_row<Record, Pointers> operator*() const { return {m_columns, m_idx}; }
+    constexpr soa_iterator& operator++() { ++m_idx; return *this; }
+    constexpr bool operator==(const soa_iterator& _rhs) const { return m_idx == _rhs.m_idx; }
+
+private:
+    Pointers m_columns;
+    size_t m_idx;
+};
+
+// N rows, each column an Array<F, N, Check>. Check: see Array, for the row index of operator[] and for the Spans.
+template <typename Record, size_t N, typename Check = default_bounds_check>
+class soa_array
+{
+    template <typename F> using column_type = Array<F, N, Check>;
+    using columns_type = soa_detail::columns_t<Record, column_type>;
+    using pointers = soa_detail::columns_t<Record, soa_detail::pointer>;
+    using const_pointers = soa_detail::columns_t<Record, soa_detail::const_pointer>;
+
+public:
+    using row = soa_row<Record, pointers>;
+    using const_row = soa_row<Record, const_pointers>;
+    template <size_t I> using field_type = std::remove_pointer_t<std::tuple_element_t<I, pointers>>;
+
+    constexpr soa_array() : m_columns() {}
+    constexpr soa_array(std::initializer_list<Record> _rows) : m_columns()
+    {
+        size_t idx = 0;
+        for (const Record& r : _rows)
+            (*this)[idx++] = r;
+    }
+
+    soa_iterator<Record, pointers> begin() { return {data(), 0}; }
+    soa_iterator<Record, pointers> end() { return {data(), N}; }
+    soa_iterator<Record, const_pointers> begin() const { return {data(), 0}; }
+    soa_iterator<Record, const_pointers> end() const { return {data(), N}; }
+    pointers data() { return soa_detail::data<pointers>(m_columns); }
+    const_pointers data() const { return soa_detail::data<const_pointers>(m_columns); }
+    constexpr size_t size() const { return N; }
+
+    row operator[](size_t idx)              { Check::index(idx, N); return {data(), idx}; }
+    const_row operator[](size_t idx) const  { Check::index(idx, N); return {data(), idx}; }
+    row at(size_t idx)                      { check_at(idx, N); return {data(), idx}; }
+    const_row at(size_t idx) const          { check_at(idx, N); return {data(), idx}; }
+
+    template <size_t I>
+    Span<field_type<I>, N, Check> column() { return {std::get<I>(m_columns).data(), N}; }
+    template <size_t I>
+    Span<const field_type<I>, N, Check> column() const { return {std::get<I>(m_columns).data(), N}; }
+
+private:
+    columns_type m_columns;
+};
+
+// as many rows as were pushed, each column a std::vector<F>
+template <typename Record, typename Check = default_bounds_check>
+class soa_vector
+{
+    template <typename F> using column_type = std::vector<F>;
+    using columns_type = soa_detail::columns_t<Record, column_type>;
+    using pointers = soa_detail::columns_t<Record, soa_detail::pointer>;
+    using const_pointers = soa_detail::columns_t<Record, soa_detail::const_pointer>;
+
+public:
+    using row = soa_row<Record, pointers>;
+    using const_row = soa_row<Record, const_pointers>;
+    template <size_t I> using field_type = std::remove_pointer_t<std::tuple_element_t<I, pointers>>;
+
+    soa_vector() = default;
+    soa_vector(std::initializer_list<Record> _rows)
+    {
+        reserve(_rows.size());
+        for (const Record& r : _rows)
+            push_back(r);
+    }
+
+    soa_iterator<Record, pointers> begin() { return {data(), 0}; }
+    soa_iterator<Record, pointers> end() { return {data(), size()}; }
+    soa_iterator<Record, const_pointers> begin() const { return {data(), 0}; }
+    soa_iterator<Record, const_pointers> end() const { return {data(), size()}; }
+    pointers data() { return soa_detail::data<pointers>(m_columns); }
+    const_pointers data() const { return soa_detail::data<const_pointers>(m_columns); }
+    size_t size() const { return std::get<0>(m_columns).size(); }
+    bool empty() const { return size() == 0; }
+
+    void reserve(size_t _capacity)  { std::apply([=](auto&... c) { (c.reserve(_capacity), ...); }, m_columns); }
+    void resize(size_t _size)       { std::apply([=](auto&... c) { (c.resize(_size), ...); }, m_columns); }
+    void clear()                    { std::apply([](auto&... c) { (c.clear(), ...); }, m_columns); }
+
+    void push_back(const Record& _row)
+    {
+        push_back(soa_detail::tie(_row), std::make_index_sequence<std::tuple_size_v<columns_type>>());
+    }
+
+    row operator[](size_t idx)              { Check::index(idx, size()); return {data(), idx}; }
+    const_row operator[](size_t idx) const  { Check::index(idx, size()); return {data(), idx}; }
+    row at(size_t idx)                      { check_at(idx, size()); return {data(), idx}; }
+    const_row at(size_t idx) const          { check_at(idx, size()); return {data(), idx}; }
+
+    template <size_t I>
+    Span<field_type<I>, dynamic_extent, Check> column() { return {std::get<I>(m_columns).data(), size()}; }
+    template <size_t I>
+    Span<const field_type<I>, dynamic_extent, Check> column() const { return {std::get<I>(m_columns).data(), size()}; }
+
+private:
+    template <typename Refs, size_t... I>
+    void push_back(const Refs& _row, std::index_sequence<I...>)
+    {
+        (std::get<I>(m_columns).push_back(std::get<I>(_row)), ...);
+    }
+
+    columns_type m_columns;
+};
+
+struct particle {
+    float x, y, z;
+    float mass;
+    int id;
+};
+
+static_assert(soa_detail::field_count<particle>() == 5);
+static_assert(std::is_same_v<soa_array<particle, 4>::field_type<4>, int>);
+
+// Sums over one member of 1M particles (20 MiB as records): every 20-byte record read for 4 bytes of it,
+// or one column of 4 MiB. The ids add up to about 5.5e11, so they are summed into a long long; the compiler
+// vectorizes those loops, while the float sums are only vectorized by simd::sum (the compiler keeps the order
+// of float additions).
+void soa_benchmark(benchmark_suite& suite)
+{
+    constexpr size_t n = 1 << 20;
+    static Array<particle, n> aos{};
+    static soa_array<particle, n> soa;
+    for (size_t i = 0; i < n; ++i)
+        soa[i] = aos[i] = {float(i), 0, 0, 1.0f + i % 3, int(i)};
+
+    suite.run("Array<particle>, .id", [&] {
+        long long sum = 0;
+        for (const particle& p : aos)
+            sum += p.id;
+        do_not_optimize(sum);
+    });
+    suite.run("soa_array<particle>, rows", [&] {
+        long long sum = 0;
+        for (auto [x, y, z, mass, id] : soa)
+            sum += id;
+        do_not_optimize(sum);
+    });
+    suite.run("soa_array<particle>, column<4>()", [&] {
+        long long sum = 0;
+        for (int id : soa.column<4>())
+            sum += id;
+        do_not_optimize(sum);
+    });
+    suite.run("Array<particle>, .mass", [&] {
+        float sum = 0;
+        for (const particle& p : aos)
+            sum += p.mass;
+        do_not_optimize(sum);
+    });
+    suite.run("soa_array<particle>, simd::sum(column<3>())", [&] {
+        float sum = simd::sum(soa.column<3>());
+        do_not_optimize(sum);
+    });
+}
+
+void soa_test()
+{
+    soa_vector<particle> ps{{0, 0, 0, 1.0f, 1}, {1, 2, 3, 2.0f, 2}};
+    ps.push_back({4, 5, 6, 3.0f, 3});
+
+    auto [x, y, z, mass, id] = ps[1]; // references into the columns
+    mass = 5.0f;
+    ps[0] = ps[2];
+    ps[2] = {7, 8, 9, 4.0f, 4};
+    for (const auto& p : ps)
+    {
+        particle copy = p;
+        printf("particle %d at (%g, %g, %g), mass %g\n", copy.id, copy.x, copy.y, copy.z, copy.mass);
+    }
+    printf("total mass %g\n", simd::sum(ps.column<3>()));
+
+    benchmark_suite suite("soa_test (1M particles, ns per sum)");
+    soa_benchmark(suite);
 }
 
 // part 2 of 2
@@ -127,11 +752,81 @@ namespace old {
     static_assert(min(3, 2, 3, 4, 5) == 2);
 }
 
+#include <utility> // pair, index_sequence
+
+namespace fold {
+    // min and old::min peel one argument off per call: n arguments instantiate n functions, each one nested in the
+    // one before, and a constant evaluation goes n calls deep. The compiler gives up at 900 instantiations
+    // (-ftemplate-depth) or 512 nested constexpr calls (-fconstexpr-depth).
+    // Here the pack is expanded in place, into a comma fold: one instantiation and one call, whatever n.
+    // Every step is a select, which the optimizer turns into a conditional move rather than a branch.
+    template <typename T, typename... Ts>
+        requires (std::is_convertible_v<Ts, T> && ...)
+    constexpr T min(const T& a, const Ts&... ts)
+    {
+        T m = a;
+        ((m = ts < m ? T(ts) : m), ...);
+        return m;
+    }
+
+    template <typename T, typename... Ts>
+        requires (std::is_convertible_v<Ts, T> && ...)
+    constexpr T max(const T& a, const Ts&... ts)
+    {
+        T m = a;
+        ((m = m < ts ? T(ts) : m), ...);
+        return m;
+    }
+
+    // both in one pass over the arguments
+    template <typename T, typename... Ts>
+        requires (std::is_convertible_v<Ts, T> && ...)
+    constexpr std::pair<T, T> minmax(const T& a, const Ts&... ts)
+    {
+        std::pair<T, T> m{a, a};
+        ((m.first = ts < m.first ? T(ts) : m.first, m.second = m.second < ts ? T(ts) : m.second), ...);
+        return m;
+    }
+}
+
 void min_test()
 {
     static_assert(min(2, 3, 4, 5) == 2);
     static_assert(min(3, 2, 3, 4, 5) == 2);
+
+    static_assert(fold::min(2, 3, 4, 5) == 2);
+    static_assert(fold::min(3, 2, 3, 4, 5) == 2);
+    static_assert(fold::max(3, 2, 3, 5, 4) == 5);
+    static_assert(fold::minmax(3, 2, 3, 5, 4) == std::pair(2, 5));
+    static_assert(fold::min(7) == 7);
+}
+
+// Compile-time benchmark: one call with MINMAX_PACK_SIZE arguments, evaluated in a static_assert,
+// through the recursive min with -DMINMAX_RECURSIVE, through fold::min otherwise.
+// g++ 12, -std=c++20 -fsyntax-only, the whole file, best of 5 (without -DMINMAX_PACK_SIZE: 0.8-0.9 s):
+//     pack size   fold::min    min (recursive)
+//     10          0.78 s       0.79 s
+//     100         0.94 s       0.79 s
+//     1000        1.26 s       error: template instantiation depth exceeds maximum of 900,
+//                              and with -ftemplate-depth=1100 -fconstexpr-depth=1100: 4.9 s
+// Up to 100 arguments both are lost in the noise; at 1000 the recursion costs 4x, if it compiles at all.
+// e.g., from the top of the repository, with the file last:
+//     g++ -std=c++20 -fsyntax-only -I. -DMINMAX_PACK_SIZE=1000 -DMINMAX_RECURSIVE -ftemplate-depth=1100 -fconstexpr-depth=1100
+#ifdef MINMAX_PACK_SIZE
+namespace minmax_pack_benchmark {
+    template <size_t... I>
+    constexpr int call(std::index_sequence<I...>)
+    {
+#ifdef MINMAX_RECURSIVE
+        return ::min(static_cast<int>(MINMAX_PACK_SIZE - I)...);
+#else
+        return fold::min(static_cast<int>(MINMAX_PACK_SIZE - I)...);
+#endif
+    }
+
+    static_assert(call(std::make_index_sequence<MINMAX_PACK_SIZE>()) == 1);
 }
+#endif
 
 // (p.4) fold expressions (c++17)
 
@@ -291,8 +986,17 @@ int main()
 {
     array_test();
     span_test();
+    span_allocation_test();
+    bounds_check_test();
+    simd_test();
+    soa_test();
     min_test();
     foldexpr_test();
     tagdispatch_test();
     ttp_test();
-}
\ No newline at end of file
+}
+
+// GCC 12 reports the -Wpsabi of the transform lambdas of simd_benchmark a second time when it lowers them, after the
+// whole file has been read, at the last token of the file: only a pragma still in effect there silences that one.
+// As the last line, this one covers no other code.
+#pragma GCC diagnostic ignored "-Wpsabi"
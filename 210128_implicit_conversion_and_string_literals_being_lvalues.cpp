@@ -28,7 +28,7 @@ const char(&r)[3] = "hi";     // OK
 
 #include <algorithm> // std::copy
 //#include <utility> // included in algorithm?
-//#include <cstdio>  // included in algorithm?
+#include <cstdio>    // puts, printf: not pulled in by <algorithm> everywhere
 
 template <typename T>
 void test(T&&)
@@ -87,8 +87,18 @@ void newtest()
     const char(*tmp)[54] = &"we can take the address if it is an lvalue expression";
 }
 
+#include "benchmark.h"
+
+// with -DBENCHMARK_COUNT_ALLOCATIONS: every implicit conversion above is an allocation, too
+void alloctest()
+{
+    report_allocations("MyString o1{\"o1\"}", [] { MyString o1{"o1"}; });
+    report_allocations("const MyString& cr = \"cr\"", [] { const MyString& cr = "cr"; });
+}
+
 int main()
 {
     oldtest(); // 200923_string_literals_are_lvalues.cpp
     newtest();
+    alloctest();
 }
\ No newline at end of file
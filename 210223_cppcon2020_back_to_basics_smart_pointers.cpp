@@ -32,7 +32,7 @@ using void_t = void;
 
 // declval
 template <typename T>
-T&& declval();
+T&& declval() noexcept; // noexcept as std::declval, so that noexcept(T(declval<T&&>())) asks about T only
 
 // is_copy_constructible
 template <typename T, typename = void_t<>>
@@ -72,6 +72,24 @@ namespace test_is_move_constructible {
     static_assert(not is_move_constructible_v<no>);
 }
 
+// is_nothrow_move_constructible
+template <typename T, typename = void_t<>>
+struct is_nothrow_move_constructible : false_type {};
+template <typename T>
+struct is_nothrow_move_constructible<T, void_t<decltype(T(declval<T&&>()))>> : bool_constant<noexcept(T(declval<T&&>()))> {};
+template <typename T>
+inline constexpr bool is_nothrow_move_constructible_v = is_nothrow_move_constructible<T>::value;
+
+namespace test_is_nothrow_move_constructible {
+    struct yes {};
+    struct may_throw { may_throw(may_throw&&) {} };
+    struct no { no(no&&) = delete; };
+
+    static_assert(is_nothrow_move_constructible_v<yes>);
+    static_assert(not is_nothrow_move_constructible_v<may_throw>);
+    static_assert(not is_nothrow_move_constructible_v<no>);
+}
+
 // enable_if
 template <bool, typename = void>
 struct enable_if {};
@@ -90,7 +108,35 @@ struct remove_reference<T&&> { using type = T; };
 template <typename T>
 using remove_reference_t = typename remove_reference<T>::type;
 
+// is_unbounded_array
+template <typename T>
+struct is_unbounded_array : false_type {};
+template <typename T>
+struct is_unbounded_array<T[]> : true_type {};
+template <typename T>
+inline constexpr bool is_unbounded_array_v = is_unbounded_array<T>::value;
+
+// remove_extent
+template <typename T>
+struct remove_extent { using type = T; };
+template <typename T>
+struct remove_extent<T[]> { using type = T; };
+template <typename T, size_t N>
+struct remove_extent<T[N]> { using type = T; };
+template <typename T>
+using remove_extent_t = typename remove_extent<T>::type;
+
+// conditional
+template <bool B, typename T, typename F>
+struct conditional { using type = T; };
+template <typename T, typename F>
+struct conditional<false, T, F> { using type = F; };
+template <bool B, typename T, typename F>
+using conditional_t = typename conditional<B, T, F>::type;
+
 // move
+// (call it as ::move, and forward as ::forward, from templates: when T involves a type from namespace std,
+//  argument dependent lookup finds std::move as well and the call becomes ambiguous)
 template <typename T>
 remove_reference_t<T>&& move(T&& rhs)
 {
@@ -131,16 +177,18 @@ namespace forward_test {
     static_assert(is_same_v<const int&, decltype(forward_tester(cra))>);
 }
 
+#include "trace.h"
+
 struct Int {
     explicit Int(int _data)
         : data(_data)
-    { puts("explicit Int(int)"); }
+    { default_trace::record("explicit Int(int)"); }
 
-    ~Int() { printf("~Int()(%d)\n", data); }
+    ~Int() { default_trace::record("~Int()(%d)", data); }
 
     // both copy- and move- constructors are declared to test perfect forwarding
-    Int(const Int& _rhs)        { this->data = _rhs.data; puts("Int(const Int&)"); }
-    Int(Int&& _rhs)             { this->data = _rhs.data; puts("Int(Int&&)"); }
+    Int(const Int& _rhs)        { this->data = _rhs.data; default_trace::record("Int(const Int&)"); }
+    Int(Int&& _rhs) noexcept    { this->data = _rhs.data; default_trace::record("Int(Int&&)"); }
 
     Int& operator=(const Int&)  = delete;
     Int& operator=(Int&&)       = delete;
@@ -156,14 +204,14 @@ struct S {
     explicit S(T&& _data)       // this is rvalue reference, not universal reference
         : data(move(_data)),    // so we should use move, not forward
           m_name()
-    { puts("explicit S(T&&)"); }
+    { default_trace::record("explicit S(T&&)"); }
 
     S(const char _name[6], T&& _data)
         : data(move(_data)),
           m_name()
     {
         for (int i = 0; i < 6; ++i) m_name[i] = _name[i];
-        puts("S(char[6], T&&)");
+        default_trace::record("S(char[6], T&&)");
     }
 
     S(const char _name[6], const T& _data)
@@ -171,10 +219,10 @@ struct S {
           m_name()
     {
         for (int i = 0; i < 6; ++i) m_name[i] = _name[i];
-        puts("S(char[6], const T&)");
+        default_trace::record("S(char[6], const T&)");
     }
 
-    ~S() { puts("~S()"); }
+    ~S() { default_trace::record("~S()"); }
 
     S(const S& _rhs)            = delete;
     S(S&& _rhs)                 = delete;
@@ -193,24 +241,80 @@ private:
     char m_name[6];
 };
 
-// Minimal implementation of a type that implements an exclusive ownership over a resource
+// The smart pointers trace to default_trace when they point to one of the classes under study, which trace their
+// own lifecycle as well, and to null_trace otherwise: a shared_ptr<int> in a benchmark records nothing, whatever
+// the build. A class opts in with a specialization of traces_lifecycle.
+template <typename T>
+inline constexpr bool traces_lifecycle = false;
+template <typename T>
+inline constexpr bool traces_lifecycle<const T> = traces_lifecycle<T>;
+template <typename T>
+inline constexpr bool traces_lifecycle<T[]> = traces_lifecycle<T>;
+template <>
+inline constexpr bool traces_lifecycle<Int> = true;
+template <typename T, typename E>
+inline constexpr bool traces_lifecycle<S<T, E>> = true;
+
+template <typename T>
+using pointer_trace = conditional_t<traces_lifecycle<T>, default_trace, null_trace>;
+
+// default_delete
+template <typename T>
+struct default_delete {
+    void operator()(T* ptr) const { delete ptr; }
+};
+template <typename T>
+struct default_delete<T[]> {
+    void operator()(T* ptr) const { delete[] ptr; }
+};
+
+// Storage for something that is usually a stateless class: the deleter of a unique_ptr, an allocator.
+// An empty class is inherited from instead of stored as a member, so it takes no space at all (empty base optimization)
+// and unique_ptr<T> stays as small as T*. Final classes cannot be inherited from, so they are stored as usual.
+template <typename T, bool = __is_empty(T) && not __is_final(T)>
+class ebo_storage : private T
+{
+public:
+    ebo_storage(const T& _value)                : T(_value) {}
+    ebo_storage(T&& _value)                     : T(::move(_value)) {}
+
+    T& value()                                  { return *this; }
+    const T& value() const                      { return *this; }
+};
+
 template <typename T>
-class unique_ptr
+class ebo_storage<T, false>
+{
+public:
+    ebo_storage(const T& _value)                : m_value(_value) {}
+    ebo_storage(T&& _value)                     : m_value(::move(_value)) {}
+
+    T& value()                                  { return m_value; }
+    const T& value() const                      { return m_value; }
+
+private:
+    T m_value;
+};
+
+// Minimal implementation of a type that implements an exclusive ownership over a resource
+// Trace: where the constructors, the destructor and the move operations report to (trace.h)
+template <typename T, typename Deleter = default_delete<T>, typename Trace = pointer_trace<T>>
+class unique_ptr : private ebo_storage<Deleter>
 {
 public:
     unique_ptr()
-        : m_data(nullptr)
+        : ebo_storage<Deleter>(Deleter()), m_data(nullptr)
     {
-        //puts("unique_ptr()");
+        Trace::record("unique_ptr()");
     }
 
-    explicit unique_ptr(T* _data)
-        : m_data(_data)
+    explicit unique_ptr(T* _data, Deleter _deleter = Deleter())
+        : ebo_storage<Deleter>(::move(_deleter)), m_data(_data)
     {
-        //puts("explicit unique_ptr(T*)");
+        Trace::record("explicit unique_ptr(T*)");
     }
 
-    ~unique_ptr()                               { release();             /*puts("~unique_ptr()");*/ }
+    ~unique_ptr()                               { destroy();             Trace::record("~unique_ptr()"); }
 
     // Copy operations are explicitly deleted
     // The copy constructor is deleted if a move operation is declared.
@@ -218,67 +322,190 @@ public:
     unique_ptr(const unique_ptr&)               = delete;
     unique_ptr& operator=(const unique_ptr&)    = delete;
 
-    // YOU MUST NOT FORGET TO RELEASE() IN THE MOVE ASSIGNMENT OPERATOR,
+    // YOU MUST NOT FORGET TO DESTROY() IN THE MOVE ASSIGNMENT OPERATOR,
     // WHILE YOU DON'T NEED SUCH A CALL IN THE MOVE CONSTRUCTOR!!!
-    unique_ptr(unique_ptr&& _rhs)               {                                         grab(_rhs);   puts("unique_ptr(unique_ptr&& _rhs)"); }
-    unique_ptr& operator=(unique_ptr&& _rhs)    { if (m_data != _rhs.m_data) { release(); grab(_rhs); } puts("unique_ptr& operator=(unique_ptr&& _rhs)"); return *this; }
+    unique_ptr(unique_ptr&& _rhs)
+        : ebo_storage<Deleter>(::move(_rhs.get_deleter())) {                   grab(_rhs);   Trace::record("unique_ptr(unique_ptr&& _rhs)"); }
+    unique_ptr& operator=(unique_ptr&& _rhs)    { if (m_data != _rhs.m_data) { destroy(); grab(_rhs); get_deleter() = ::move(_rhs.get_deleter()); } Trace::record("unique_ptr& operator=(unique_ptr&& _rhs)"); return *this; }
+
+    T* get() { return m_data; }
+    Deleter& get_deleter() { return this->value(); }
+
+    // gives up the ownership without destroying anything
+    T* release()                                { T* ret = m_data; m_data = nullptr; return ret; }
+
+private:
+    void destroy()                              { if (m_data) get_deleter()(m_data); }
+    void grab(unique_ptr& _rhs)                 { this->m_data = _rhs.m_data; _rhs.m_data = nullptr; }
+
+    T* m_data;
+};
+
+// unique_ptr<T[]> owns a whole array: it is indexed instead of dereferenced, and its default deleter calls delete[]
+// Trace: as for unique_ptr<T>
+template <typename T, typename Deleter, typename Trace>
+class unique_ptr<T[], Deleter, Trace> : private ebo_storage<Deleter>
+{
+public:
+    unique_ptr()
+        : ebo_storage<Deleter>(Deleter()), m_data(nullptr)
+    {
+        Trace::record("unique_ptr<T[]>()");
+    }
+
+    explicit unique_ptr(T* _data, Deleter _deleter = Deleter())
+        : ebo_storage<Deleter>(::move(_deleter)), m_data(_data)
+    {
+        Trace::record("explicit unique_ptr<T[]>(T*)");
+    }
+
+    ~unique_ptr()                               { destroy();             Trace::record("~unique_ptr<T[]>()"); }
+
+    unique_ptr(const unique_ptr&)               = delete;
+    unique_ptr& operator=(const unique_ptr&)    = delete;
+
+    unique_ptr(unique_ptr&& _rhs)
+        : ebo_storage<Deleter>(::move(_rhs.get_deleter())) {                   grab(_rhs);   Trace::record("unique_ptr<T[]>(unique_ptr&& _rhs)"); }
+    unique_ptr& operator=(unique_ptr&& _rhs)    { if (m_data != _rhs.m_data) { destroy(); grab(_rhs); get_deleter() = ::move(_rhs.get_deleter()); } Trace::record("unique_ptr<T[]>& operator=(unique_ptr&& _rhs)"); return *this; }
 
     T* get() { return m_data; }
+    Deleter& get_deleter() { return this->value(); }
+
+    // gives up the ownership without destroying anything
+    T* release()                                { T* ret = m_data; m_data = nullptr; return ret; }
+
+    T& operator[](size_t idx)                   { return m_data[idx]; }
+    const T& operator[](size_t idx) const       { return m_data[idx]; }
 
 private:
-    void release()                              { if (m_data) delete m_data; }
+    void destroy()                              { if (m_data) get_deleter()(m_data); }
     void grab(unique_ptr& _rhs)                 { this->m_data = _rhs.m_data; _rhs.m_data = nullptr; }
 
     T* m_data;
 };
 
 template <typename T, typename... Args>
-unique_ptr<T> make_unique(Args&&... args)
+enable_if_t<not is_unbounded_array_v<T>, unique_ptr<T>> make_unique(Args&&... args)
 {
     //return unique_ptr<T>(new T(forward<Args...>(args...)));   // THIS DOES NOT WORK!!!
-    return unique_ptr<T>(new T(forward<Args>(args)...));        // THIS IS THE RIGHT SYNTAX!!!
+    return unique_ptr<T>(new T(::forward<Args>(args)...));      // THIS IS THE RIGHT SYNTAX!!!
+}
+
+// make_unique<T[]>(n): n value-initialized elements
+template <typename T>
+enable_if_t<is_unbounded_array_v<T>, unique_ptr<T>> make_unique(size_t n)
+{
+    return unique_ptr<T>(new remove_extent_t<T>[n]());
+}
+
+// make_unique_for_overwrite: default-initialized instead of value-initialized, for buffers that are written before
+// they are read. For a trivially constructible T that means no initialization at all: make_unique<char[]>(n) writes
+// n zeroes, make_unique_for_overwrite<char[]>(n) writes nothing, and the memory holds whatever it held before.
+template <typename T>
+enable_if_t<not is_unbounded_array_v<T>, unique_ptr<T>> make_unique_for_overwrite()
+{
+    return unique_ptr<T>(new T);    // no parentheses: default-initialization
+}
+
+template <typename T>
+enable_if_t<is_unbounded_array_v<T>, unique_ptr<T>> make_unique_for_overwrite(size_t n)
+{
+    return unique_ptr<T>(new remove_extent_t<T>[n]);
+}
+
+#include <memory> // allocator_traits
+#include <new>
+
+// Deleter for objects made by allocate_unique: destroys and frees through the allocator that made the object.
+// Only allocators whose pointer type is a plain T* are supported.
+template <typename Alloc>
+class allocator_delete : private ebo_storage<Alloc>
+{
+    using traits = std::allocator_traits<Alloc>;
+
+public:
+    allocator_delete()
+        : ebo_storage<Alloc>(Alloc())
+    {}
+
+    explicit allocator_delete(const Alloc& _alloc)
+        : ebo_storage<Alloc>(_alloc)
+    {}
+
+    void operator()(typename traits::value_type* ptr)
+    {
+        traits::destroy(this->value(), ptr);
+        traits::deallocate(this->value(), ptr, 1);
+    }
+};
+
+template <typename Alloc, typename T>
+using rebind_alloc_t = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+template <typename T, typename Alloc, typename... Args>
+unique_ptr<T, allocator_delete<rebind_alloc_t<Alloc, T>>> allocate_unique(const Alloc& alloc, Args&&... args)
+{
+    using traits = std::allocator_traits<rebind_alloc_t<Alloc, T>>;
+
+    rebind_alloc_t<Alloc, T> object_alloc(alloc);
+    T* ptr = traits::allocate(object_alloc, 1);
+    try
+    {
+        traits::construct(object_alloc, ptr, ::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        traits::deallocate(object_alloc, ptr, 1);
+        throw;
+    }
+    return unique_ptr<T, allocator_delete<rebind_alloc_t<Alloc, T>>>(ptr, allocator_delete<rebind_alloc_t<Alloc, T>>(object_alloc));
 }
 
 namespace alternative
 {
     // Minimal implementation of a type that implements an exclusive ownership over a resource
     // - (Resharper) noexcept specification in move operations
-    // - (Resharper) deleting null pointer has no effect
-    template <typename T>
-    class unique_ptr
+    // - (Resharper) deleting null pointer has no effect (but a custom deleter may not expect one, so we check)
+    template <typename T, typename Deleter = default_delete<T>, typename Trace = pointer_trace<T>>
+    class unique_ptr : private ebo_storage<Deleter>
     {
     public:
         unique_ptr()
-            : m_data(nullptr)
+            : ebo_storage<Deleter>(Deleter()), m_data(nullptr)
         {}
 
-        explicit unique_ptr(T* _data)
-            : m_data(_data)
+        explicit unique_ptr(T* _data, Deleter _deleter = Deleter())
+            : ebo_storage<Deleter>(::move(_deleter)), m_data(_data)
         {}
 
         ~unique_ptr()
         {
-            delete m_data;
+            reset(nullptr);
         }
 
         unique_ptr(const unique_ptr&)               = delete;
         unique_ptr& operator=(const unique_ptr&)    = delete;
 
         unique_ptr(unique_ptr&& _rhs) noexcept
+            : ebo_storage<Deleter>(::move(_rhs.get_deleter()))
         {
-            puts("unique_ptr(unique_ptr&& _rhs)");
+            Trace::record("unique_ptr(unique_ptr&& _rhs)");
             m_data = _rhs.release();
         }
 
         unique_ptr& operator=(unique_ptr&& _rhs) noexcept
         {
-            puts("unique_ptr& operator=(unique_ptr&& _rhs)");
+            Trace::record("unique_ptr& operator=(unique_ptr&& _rhs)");
             if (m_data != _rhs.m_data)
+            {
                 reset(_rhs.release());
+                get_deleter() = ::move(_rhs.get_deleter());
+            }
             return *this;
         }
 
         T* get() { return m_data; }
+        Deleter& get_deleter() { return this->value(); }
 
         T* release()
         {
@@ -288,12 +515,17 @@ namespace alternative
         void reset(T* new_data)
         {
             T* old = exchange(new_data);
-            delete old;
+            if (old)
+                get_deleter()(old);
         }
 
         void swap(unique_ptr& _rhs) noexcept
         {
             _rhs.m_data = exchange(_rhs.m_data);
+
+            Deleter tmp = ::move(get_deleter());
+            get_deleter() = ::move(_rhs.get_deleter());
+            _rhs.get_deleter() = ::move(tmp);
         }
 
     private:
@@ -308,302 +540,3099 @@ namespace alternative
     };
 }
 
-template <typename T>
-class shared_ptr
+#include <cstddef> // max_align_t
+
+// Owns a single object like unique_ptr<T>, but keeps it inside the handle itself when it fits in Capacity bytes,
+// so that a small object costs neither an allocation nor an indirection. Whether T fits is known at compile time:
+// the handle is either the object and a flag, or a pointer to the heap, as large as unique_ptr<T>.
+// Unlike with unique_ptr, moving an inline object runs T's move constructor, and there is no release():
+// an object that lives in the handle cannot be handed over as a raw pointer.
+// So only a T that moves without throwing is kept inline: one that cannot be moved at all (S<T>) or might throw
+// goes to the heap whatever its size, and the handle moves like a pointer, never failing halfway.
+template <typename T, size_t Capacity = 2 * sizeof(void*),
+          bool = sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t) && is_nothrow_move_constructible_v<T>>
+class inplace_unique
 {
 public:
-    shared_ptr()
-        : m_data(nullptr), m_counter(nullptr)
-    {
-        //puts("shared_ptr()");
-    }
+    inplace_unique()
+        : m_engaged(false)
+    {}
 
-    explicit shared_ptr(T* data)
-        : m_data(data), m_counter(new unsigned)
+    ~inplace_unique()                               { reset(); }
+
+    inplace_unique(const inplace_unique&)               = delete;
+    inplace_unique& operator=(const inplace_unique&)    = delete;
+
+    inplace_unique(inplace_unique&& _rhs) noexcept
+        : m_engaged(false)
     {
-        //puts("explicit shared_ptr(T*)");
-        *m_counter = 1;
+        grab(_rhs);
     }
 
-    ~shared_ptr()
+    inplace_unique& operator=(inplace_unique&& _rhs) noexcept
     {
-        //puts("~shared_ptr()");
-        if (m_data && not --*m_counter)
+        if (this != &_rhs)
         {
-            delete m_data;
-            delete m_counter;
+            reset();
+            grab(_rhs);
         }
+        return *this;
     }
 
-    shared_ptr(const shared_ptr& _rhs)
-        : m_data(_rhs.m_data), m_counter(_rhs.m_counter)
-    {
-        puts("shared_ptr(const shared_ptr& _rhs)");
-        if (_rhs.m_counter)
-            ++*(_rhs.m_counter);
-    }
+    T* get()                                        { return m_engaged ? &m_object : nullptr; }
+    const T* get() const                            { return m_engaged ? &m_object : nullptr; }
 
-    shared_ptr(shared_ptr&& _rhs)
-        : m_data(_rhs.m_data), m_counter(_rhs.m_counter)
+    void reset()
     {
-        puts("shared_ptr(shared_ptr&& _rhs)");
-        _rhs.m_data = nullptr;
-        _rhs.m_counter = nullptr;
+        if (m_engaged)
+            m_object.~T();
+        m_engaged = false;
     }
 
-    shared_ptr& operator=(const shared_ptr& _rhs)
-    {
-        puts("shared_ptr& operator=(const shared_ptr& _rhs)");
-        if (this->m_data)
-            if (not --*m_counter)
-            {
-                delete m_data;
-                delete m_counter;
-            }
+private:
+    template <typename U, size_t C, typename... Args>
+    friend inplace_unique<U, C> make_inplace_unique(Args&&... args);
 
-        this->m_data = _rhs.m_data;
-        this->m_counter = _rhs.m_counter;
-        ++*(this->m_counter);
+    struct construct_tag {};
 
-        return *this;
-    }
+    template <typename... Args>
+    explicit inplace_unique(construct_tag, Args&&... args)
+        : m_object(::forward<Args>(args)...), m_engaged(true)
+    {}
 
-    shared_ptr& operator=(shared_ptr&& _rhs)
+    // moves the object over and leaves _rhs empty, like a moved-from unique_ptr
+    void grab(inplace_unique& _rhs)
     {
-        puts("shared_ptr& operator=(shared_ptr&& _rhs)");
-        if (this->m_data)
-            if (not --*m_counter)
-            {
-                delete m_data;
-                delete m_counter;
-            }
+        if (not _rhs.m_engaged)
+            return;
+        ::new (static_cast<void*>(&m_object)) T(::move(_rhs.m_object));
+        m_engaged = true;
+        _rhs.reset();
+    }
 
-        this->m_data = _rhs.m_data;
-        this->m_counter = _rhs.m_counter;
+    union { T m_object; };
+    bool m_engaged;
+};
+
+// too large (or too aligned) to be kept inline: unique_ptr<T> all over again
+template <typename T, size_t Capacity>
+class inplace_unique<T, Capacity, false>
+{
+public:
+    inplace_unique()
+        : m_data(nullptr)
+    {}
+
+    ~inplace_unique()                               { reset(); }
+
+    inplace_unique(const inplace_unique&)               = delete;
+    inplace_unique& operator=(const inplace_unique&)    = delete;
 
+    inplace_unique(inplace_unique&& _rhs)
+        : m_data(_rhs.m_data)
+    {
         _rhs.m_data = nullptr;
-        _rhs.m_counter = nullptr;
+    }
 
+    inplace_unique& operator=(inplace_unique&& _rhs)
+    {
+        if (this != &_rhs)
+        {
+            reset();
+            m_data = _rhs.m_data;
+            _rhs.m_data = nullptr;
+        }
         return *this;
     }
 
-    const T* get() const        { return m_data; }
-    unsigned use_count() const  { return *m_counter; }
+    T* get()                                        { return m_data; }
+    const T* get() const                            { return m_data; }
+
+    void reset()
+    {
+        delete m_data;
+        m_data = nullptr;
+    }
 
 private:
-    T* m_data;
-    unsigned* m_counter;
-};
+    template <typename U, size_t C, typename... Args>
+    friend inplace_unique<U, C> make_inplace_unique(Args&&... args);
 
-template <typename T, typename... Args>
-shared_ptr<T> make_shared(Args&&... args)
-{
-    return shared_ptr<T>(new T(forward<Args>(args)...));
-}
+    struct construct_tag {};
 
-#include <iostream>
+    template <typename... Args>
+    explicit inplace_unique(construct_tag, Args&&... args)
+        : m_data(new T(::forward<Args>(args)...))
+    {}
 
-struct uptr_tag {};
-struct sptr_tag {};
+    T* m_data;
+};
 
-template <typename T>
-void print_helper(uptr_tag, const S<T>* const ptr)
+template <typename T, size_t Capacity = 2 * sizeof(void*), typename... Args>
+inplace_unique<T, Capacity> make_inplace_unique(Args&&... args)
 {
-    printf("%p", ptr);
-    if (ptr)
-        std::cout << " [" << ptr->name() << "](" << ptr->get() << ")\n";
-    else
-        std::cout << "\n";
+    return inplace_unique<T, Capacity>(typename inplace_unique<T, Capacity>::construct_tag(), ::forward<Args>(args)...);
 }
 
+// box<T>: inplace_unique with the default capacity, two pointers' worth
 template <typename T>
-void print_helper(sptr_tag, T&& ptr)
-{
-    printf("%p", ptr.get());
-    if (ptr.get())
-        std::cout << " [" << ptr.get()->name() << "](" << ptr.get()->get() << ") count:" << ptr.use_count() << "\n";
-    else
-        std::cout << "\n";
-}
+using box = inplace_unique<T>;
 
-template <typename PtrT, typename T, typename... Ts>
-void _print(PtrT t, T&& arg, Ts&&... args)
+template <typename T, typename... Args>
+box<T> make_box(Args&&... args)
 {
-    print_helper(t, forward<T>(arg));
-    if constexpr(sizeof...(args) > 0)
-        _print(t, forward<Ts>(args)...);
+    return make_inplace_unique<T>(::forward<Args>(args)...);
 }
 
-template <typename PtrT, typename... Ts>
-void print(PtrT t, Ts&&... args)
-{
-    std::cout << "\n";
-    _print(t, forward<Ts>(args)...);
-    std::cout << "\n";
+namespace test_unique_ptr_size {
+    struct stateless_deleter { void operator()(int* ptr) const { delete ptr; } };
+    struct stateful_deleter { void operator()(int* ptr) const { delete ptr; } int pool_id; };
+
+    static_assert(sizeof(unique_ptr<int>) == sizeof(int*));
+    static_assert(sizeof(unique_ptr<int[]>) == sizeof(int*));
+    static_assert(sizeof(unique_ptr<int, stateless_deleter>) == sizeof(int*));
+    static_assert(sizeof(unique_ptr<int, stateful_deleter>) > sizeof(int*));
+    static_assert(sizeof(unique_ptr<int, void(*)(int*)>) == 2 * sizeof(int*));
+    static_assert(sizeof(alternative::unique_ptr<int>) == sizeof(int*));
+    static_assert(sizeof(alternative::unique_ptr<int, stateless_deleter>) == sizeof(int*));
+    static_assert(sizeof(allocate_unique<int>(std::allocator<int>(), 0)) == sizeof(int*));
+
+    struct large { char data[64]; };
+
+    static_assert(sizeof(box<int>) == sizeof(int*));                 // the int and the flag
+    static_assert(sizeof(box<S<Int>>) == sizeof(void*));             // would fit, but cannot be moved: on the heap
+    static_assert(sizeof(inplace_unique<large, 16>) == sizeof(large*)); // does not fit, so it is a pointer
+    static_assert(sizeof(inplace_unique<large, 64>) > sizeof(large));
 }
 
-void test_unique_ptr()
+#include <atomic>
+
+// Counting policies for shared_ptr
+// - nonatomic_count: plain increments, every handle sharing the count must stay on one thread
+// - atomic_count: handles may be copied and destroyed on any thread.
+//   Taking another reference needs no ordering (relaxed), because the one who copies already holds a reference.
+//   Dropping a reference must publish our writes to the object (release), and the one who drops the last
+//   reference must see every other thread's writes before it destroys the object (acquire).
+class nonatomic_count
 {
-    unique_ptr<S<Int>> uptr1{new S("uptr1", Int{1})};
-    print(uptr_tag{}, uptr1.get());
+public:
+    explicit nonatomic_count(unsigned _count)
+        : m_count(_count)
+    {}
 
-    auto uptr2 = make_unique<S<Int>>("uptr2", Int{2});
-    print(uptr_tag{}, uptr1.get(), uptr2.get());
+    void increment()                { ++m_count; }
+    bool increment_if_nonzero()     { return m_count ? ++m_count : false; }
+    bool decrement()                { return not --m_count; } // true if the last reference was dropped
+    unsigned load() const           { return m_count; }
 
-    unique_ptr<S<Int>> uptr3;
+private:
+    unsigned m_count;
+};
+
+class atomic_count
+{
+public:
+    explicit atomic_count(unsigned _count)
+        : m_count(_count)
+    {}
+
+    void increment()                { m_count.fetch_add(1, std::memory_order_relaxed); }
+    bool increment_if_nonzero()
     {
-        Int tmp{3};
-        uptr3 = make_unique<S<Int>>("uptr3", tmp);
+        unsigned count = m_count.load(std::memory_order_relaxed);
+        while (count)
+            if (m_count.compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+                return true;
+        return false;
     }
-    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get());
+    bool decrement()
+    {
+        if (m_count.fetch_sub(1, std::memory_order_release) != 1)
+            return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+    unsigned load() const           { return m_count.load(std::memory_order_relaxed); }
 
-    uptr1 = move(uptr2);
-    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get());
+private:
+    std::atomic<unsigned> m_count;
+};
 
-    auto uptr4(move(uptr3));
-    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get(), uptr4.get());
+// Biased reference counting (Choi, Shull, Torrellas, PACT 2018).
+// Most copies of a handle are made and dropped on the thread that created the object, so that thread (the owner)
+// counts in a counter of its own without atomic read-modify-writes; only the other threads pay for atomics, on a
+// second, shared counter. The object is alive as long as the sum of the two is not zero.
+// - when the owner's count drops to zero, the owner merges the two: from then on everyone uses the shared counter,
+//   and whoever takes it to zero destroys the object
+// - a reference taken on the owner thread may be dropped on another one, taking the shared counter below zero.
+//   The sum may be zero now, but only the owner can tell, so the count is queued to its owner, which merges it
+//   the next time it drops one of its own references, calls merge_queued(), or exits.
+//   Until then, the object stays alive.
+// The owner's counter is atomic so that others may read it for use_count() and merge it after the owner exited,
+// but the owner only ever loads and stores it (relaxed), which compiles to plain moves.
+class biased_count
+{
+    struct owner_thread
+    {
+        std::atomic<biased_count*> queue{nullptr};  // linked through m_next_queued
+        std::atomic<bool> exited{false};
+        std::atomic<unsigned> refs{1};              // the thread itself and every count it owns
 
-    uptr1 = move(uptr1);
-    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get(), uptr4.get());
-}
+        void release()
+        {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+    };
 
-void test_shared_ptr()
-{
-    shared_ptr<S<Int>> sptr1{new S("sptr1", Int{1})};
-    print(sptr_tag{}, sptr1);
+    // the shared counter: the count in the upper bits, two flags in the lower ones
+    static constexpr long long merged   = 1;        // the owner's count has been added to the shared one
+    static constexpr long long queued   = 2;        // the count is waiting in its owner's queue to be merged
+    static constexpr long long one      = 4;
 
-    auto sptr2 = make_shared<S<Int>>("sptr2", Int{2});
-    print(sptr_tag{}, sptr1, sptr2);
+    static long long count(long long shared)        { return shared >> 2; }
 
-    shared_ptr<S<Int>> sptr3;
+public:
+    explicit biased_count(unsigned _count)
+        : m_owner(this_thread()), m_biased(_count), m_merged(false), m_shared(0), m_next_queued(nullptr),
+          m_on_zero(nullptr), m_context(nullptr)
     {
-        Int tmp{3};
-        sptr3 = make_shared<S<Int>>("sptr3", tmp);
+        m_owner->refs.fetch_add(1, std::memory_order_relaxed);
     }
-    print(sptr_tag{}, sptr1, sptr2, sptr3);
 
-    sptr1 = sptr2;
-    print(sptr_tag{}, sptr1, sptr2, sptr3);
+    ~biased_count()             { m_owner->release(); }
 
-    sptr1 = move(sptr3);
-    print(sptr_tag{}, sptr1, sptr2, sptr3);
+    biased_count(const biased_count&)               = delete;
+    biased_count& operator=(const biased_count&)    = delete;
 
-    auto sptr4(move(sptr1));
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+    // what to call when the count drops to zero while it is merged from the queue, rather than in decrement()
+    void on_zero(void (*_on_zero)(void*), void* _context)
+    {
+        m_on_zero = _on_zero;
+        m_context = _context;
+    }
 
-    sptr3 = sptr4;
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+    void increment()
+    {
+        if (owned())
+            m_biased.store(m_biased.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        else
+            m_shared.fetch_add(one, std::memory_order_relaxed);
+    }
 
-    sptr1 = move(sptr3);
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+    bool increment_if_nonzero()
+    {
+        if (owned())
+        {
+            increment(); // the owner's count is never zero before the merge
+            return true;
+        }
 
-    sptr1 = move(sptr2);
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+        // An unmerged count may be zero in sum, waiting in the queue: but then the object was not destroyed yet,
+        // and the owner will count our reference as well when it merges. Once merged, zero is final.
+        long long shared = m_shared.load(std::memory_order_relaxed);
+        while (not (shared & merged) || count(shared) > 0)
+            if (m_shared.compare_exchange_weak(shared, shared + one, std::memory_order_relaxed))
+                return true;
+        return false;
+    }
 
-    sptr1 = move(sptr4);
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+    bool decrement()
+    {
+        if (owned())
+        {
+            const unsigned biased = m_biased.load(std::memory_order_relaxed) - 1;
+            m_biased.store(biased, std::memory_order_relaxed);
+            if (not biased)
+                return merge();
+
+            // a good moment to merge what the others queued to us (this count included, so do not touch it afterwards)
+            if (m_owner->queue.load(std::memory_order_relaxed))
+                drain(m_owner);
+            return false;
+        }
 
-    auto sptr5(sptr1);
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4, sptr5);
+        long long shared = m_shared.load(std::memory_order_relaxed);
+        long long next;
+        do
+        {
+            next = shared - one;
+            if (not (shared & merged) && count(next) < 0)
+                next |= queued;
+        } while (not m_shared.compare_exchange_weak(shared, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+        if (next & merged)
+            return count(next) == 0 && not (next & queued);
+
+        if ((next & queued) && not (shared & queued))
+            enqueue();
+        return false;
+    }
+
+    unsigned load() const
+    {
+        const long long shared = count(m_shared.load(std::memory_order_relaxed));
+        return static_cast<unsigned>(shared + (m_merged.load(std::memory_order_relaxed) ? 0 : m_biased.load(std::memory_order_relaxed)));
+    }
+
+    // merges the counts that other threads queued to the calling thread
+    static void merge_queued()
+    {
+        drain(this_thread());
+    }
+
+private:
+    static owner_thread* this_thread()
+    {
+        static thread_local owner_thread* me = nullptr; // constant initialized, so every access is a plain TLS load
+        if (not me)
+        {
+            // merges whatever is still queued to us when the thread exits.
+            // The record itself lives on until the last count owned by this thread is gone.
+            static thread_local struct exit_hook {
+                owner_thread* record = new owner_thread;
+                ~exit_hook()
+                {
+                    record->exited.store(true);
+                    drain(record);
+                    record->release();
+                }
+            } hook;
+            me = hook.record;
+        }
+        return me;
+    }
+
+    bool owned() const          { return m_owner == this_thread() && not m_merged.load(std::memory_order_relaxed); }
+
+    // the owner hands its count over to the shared counter; true if the object is to be destroyed right now
+    bool merge()
+    {
+        const long long biased = m_biased.load(std::memory_order_relaxed);
+        m_biased.store(0, std::memory_order_relaxed);
+        m_merged.store(true, std::memory_order_relaxed);
+
+        const long long shared = m_shared.fetch_add(biased * one + merged, std::memory_order_acq_rel);
+        return count(shared) + biased == 0 && not (shared & queued); // a queued count is finished by drain()
+    }
+
+    void enqueue()
+    {
+        // once we are in the queue, the owner may merge and destroy us, and let go of its record
+        owner_thread* owner = m_owner;
+        owner->refs.fetch_add(1, std::memory_order_relaxed);
+
+        m_next_queued = owner->queue.load(std::memory_order_relaxed);
+        while (not owner->queue.compare_exchange_weak(m_next_queued, this))
+            ;
+
+        // an owner that is gone cannot merge, so we do it ourselves
+        if (owner->exited.load())
+            drain(owner);
+        owner->release();
+    }
+
+    static void drain(owner_thread* owner)
+    {
+        biased_count* counter = owner->queue.exchange(nullptr, std::memory_order_acquire);
+        while (counter)
+        {
+            biased_count* next = counter->m_next_queued; // the counter may be gone after the merge
+
+            if (not counter->m_merged.load(std::memory_order_relaxed))
+                counter->merge();
+
+            const long long shared = counter->m_shared.fetch_and(~queued, std::memory_order_acq_rel);
+            if (count(shared) == 0)
+                counter->m_on_zero(counter->m_context);
+
+            counter = next;
+        }
+    }
+
+    owner_thread* const m_owner;
+    std::atomic<unsigned> m_biased;
+    std::atomic<bool> m_merged;     // only written by the owner (or after it is gone)
+    std::atomic<long long> m_shared;
+    biased_count* m_next_queued;
+    void (*m_on_zero)(void*);
+    void* m_context;
+};
+
+// Everything the handles of one object share: the counts, and how to get rid of the object and of the block itself.
+// The object is destroyed when the last shared_ptr goes away (dispose),
+// the block is freed when the last weak_ptr goes away as well (destroy).
+// All the shared_ptrs together hold a single weak reference, so the owners only touch m_weak once, at the very end.
+template <typename CountPolicy>
+class control_block
+{
+public:
+    control_block()
+        : m_uses(1), m_weak(1)
+    {
+        // biased_count may drop to zero outside of release(), when its owner merges it: tell it how to finish then
+        if constexpr (requires { m_uses.on_zero(nullptr, nullptr); })
+        {
+            m_uses.on_zero([](void* self) { static_cast<control_block*>(self)->last_use_gone(); }, this);
+            m_weak.on_zero([](void* self) { static_cast<control_block*>(self)->destroy(); }, this);
+        }
+    }
+
+    void add_ref()              { m_uses.increment(); }
+    bool add_ref_if_alive()     { return m_uses.increment_if_nonzero(); }
+    void release()
+    {
+        if (m_uses.decrement())
+            last_use_gone();
+    }
+    unsigned use_count() const  { return m_uses.load(); }
+
+    virtual void* object()      = 0; // the managed object, for those who only have the block (atomic_shared_ptr)
+
+    void add_weak_ref()         { m_weak.increment(); }
+    void release_weak()
+    {
+        if (m_weak.decrement())
+            destroy();
+    }
+
+    control_block(const control_block&)             = delete;
+    control_block& operator=(const control_block&)  = delete;
+
+protected:
+    ~control_block()            = default; // blocks are only ever freed by destroy()
+
+private:
+    void last_use_gone()
+    {
+        dispose();
+        release_weak();
+    }
+
+    virtual void dispose()      = 0;
+    virtual void destroy()      = 0;
+
+    CountPolicy m_uses;
+    CountPolicy m_weak;
+};
+
+// shared_ptr(T*): the object was allocated by the caller, the block only remembers where it is (and how to get rid of it)
+template <typename T, typename CountPolicy, typename Deleter = default_delete<T>>
+class pointer_control_block final : public control_block<CountPolicy>, private ebo_storage<Deleter>
+{
+public:
+    explicit pointer_control_block(T* _data, Deleter _deleter = Deleter())
+        : ebo_storage<Deleter>(::move(_deleter)), m_data(_data)
+    {}
+
+    void* object() override     { return m_data; }
+
+private:
+    void dispose() override     { this->value()(m_data); }
+    void destroy() override     { delete this; }
+
+    T* m_data;
+};
+
+// make_shared: the object is constructed inside the block, so the object and its count come from one allocation
+// and the count sits right next to the object it counts
+struct for_overwrite_t {};
+
+template <typename T, typename CountPolicy>
+class inplace_control_block final : public control_block<CountPolicy>
+{
+public:
+    template <typename... Args>
+    explicit inplace_control_block(Args&&... args)
+        : m_object(::forward<Args>(args)...)
+    {}
+
+    // make_shared_for_overwrite: default-initialized, so a trivially constructible object is left as it is
+    explicit inplace_control_block(for_overwrite_t)
+    {
+        ::new (static_cast<void*>(&m_object)) T;
+    }
+
+    ~inplace_control_block()    {} // m_object is already gone by the time the block is destroyed
+
+    T* get()                    { return &m_object; }
+    void* object() override     { return &m_object; }
+
+private:
+    void dispose() override     { m_object.~T(); }
+    void destroy() override     { delete this; }
+
+    union { T m_object; };      // a union member is neither constructed nor destroyed implicitly
+};
+
+// make_shared_for_overwrite<T[]>(n): the block and the n elements that follow it come from one allocation.
+// The elements are default-initialized, so for a trivially constructible T nothing is written to them at all.
+template <typename T, typename CountPolicy>
+class array_control_block final : public control_block<CountPolicy>
+{
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "the elements must not need more than operator new gives");
+
+    // the first element, right after the block, rounded up to the alignment of T
+    static constexpr size_t elements_offset()   { return (sizeof(array_control_block) + alignof(T) - 1) / alignof(T) * alignof(T); }
+
+public:
+    static array_control_block* create(size_t n)
+    {
+        void* memory = ::operator new(elements_offset() + n * sizeof(T));
+        auto* block = ::new (memory) array_control_block(n);
+
+        size_t constructed = 0;
+        try
+        {
+            for (; constructed < n; ++constructed)
+                ::new (static_cast<void*>(block->get() + constructed)) T;   // a no-op for a trivial T
+        }
+        catch (...)
+        {
+            block->m_size = constructed;
+            block->dispose();
+            block->destroy();
+            throw;
+        }
+        return block;
+    }
+
+    T* get()                    { return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + elements_offset()); }
+    void* object() override     { return get(); }
+
+private:
+    explicit array_control_block(size_t n)
+        : m_size(n)
+    {}
+
+    void dispose() override
+    {
+        for (size_t i = m_size; i > 0; --i)
+            get()[i - 1].~T();
+    }
+    void destroy() override
+    {
+        this->~array_control_block();
+        ::operator delete(this);
+    }
+
+    size_t m_size;
+};
+
+// make_shared_batch: n objects, each with a block of its own, all of them in one allocation behind a batch_header.
+// Every object lives and dies on its own (counts, weak_ptrs, dispose), only the memory is shared:
+// the last block of the batch to be destroyed frees it all.
+// The blocks of one batch may be destroyed by different threads, unless they all count without atomics.
+template <typename CountPolicy>
+struct batch_count { using type = atomic_count; };
+template <>
+struct batch_count<nonatomic_count> { using type = nonatomic_count; };
+
+template <typename CountPolicy>
+struct batch_header {
+    typename batch_count<CountPolicy>::type blocks;     // blocks of the batch not destroyed yet
+};
+
+template <typename T, typename CountPolicy>
+class batch_control_block final : public control_block<CountPolicy>
+{
+    using header = batch_header<CountPolicy>;
+
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "the objects must not need more than operator new gives");
+
+    // the first block, right after the header
+    static constexpr size_t blocks_offset()     { return (sizeof(header) + alignof(batch_control_block) - 1) / alignof(batch_control_block) * alignof(batch_control_block); }
+
+public:
+    // n blocks (n > 0), each object constructed from the same args
+    template <typename... Args>
+    static batch_control_block* create(size_t n, const Args&... args)
+    {
+        void* memory = ::operator new(blocks_offset() + n * sizeof(batch_control_block));
+        auto* batch = ::new (memory) header{typename batch_count<CountPolicy>::type(static_cast<unsigned>(n))};
+        auto* blocks = reinterpret_cast<batch_control_block*>(static_cast<char*>(memory) + blocks_offset());
+
+        size_t constructed = 0;
+        try
+        {
+            for (; constructed < n; ++constructed)
+                ::new (static_cast<void*>(blocks + constructed)) batch_control_block(batch, args...);
+        }
+        catch (...)
+        {
+            while (constructed > 0)
+            {
+                batch_control_block& block = blocks[--constructed];
+                block.dispose();
+                block.~batch_control_block();
+            }
+            batch->~header();
+            ::operator delete(memory);
+            throw;
+        }
+        return blocks;
+    }
+
+    ~batch_control_block()      {} // m_object is already gone by the time the block is destroyed
+
+    T* get()                    { return &m_object; }
+    void* object() override     { return &m_object; }
+
+private:
+    template <typename... Args>
+    explicit batch_control_block(header* _batch, const Args&... args)
+        : m_batch(_batch), m_object(args...)
+    {}
+
+    void dispose() override     { m_object.~T(); }
+    void destroy() override
+    {
+        header* batch = m_batch;
+        this->~batch_control_block();
+        if (batch->blocks.decrement())
+        {
+            batch->~header();
+            ::operator delete(batch);
+        }
+    }
+
+    header* m_batch;
+    union { T m_object; };
+};
+
+// allocate_shared: like inplace_control_block, but the block comes from (and goes back to) an allocator it carries along.
+// Alloc is rebound to T, it is used to construct and destroy the object.
+template <typename T, typename CountPolicy, typename Alloc>
+class allocator_control_block final : public control_block<CountPolicy>, private ebo_storage<Alloc>
+{
+    using block_alloc = rebind_alloc_t<Alloc, allocator_control_block>;
+
+public:
+    template <typename... Args>
+    explicit allocator_control_block(const Alloc& alloc, Args&&... args)
+        : ebo_storage<Alloc>(alloc)
+    {
+        std::allocator_traits<Alloc>::construct(this->value(), &m_object, ::forward<Args>(args)...);
+    }
+
+    ~allocator_control_block()  {}
+
+    T* get()                    { return &m_object; }
+    void* object() override     { return &m_object; }
+
+private:
+    void dispose() override     { std::allocator_traits<Alloc>::destroy(this->value(), &m_object); }
+    void destroy() override
+    {
+        block_alloc alloc(this->value()); // the allocator lives in the block we are about to free, so copy it out first
+        this->~allocator_control_block();
+        std::allocator_traits<block_alloc>::deallocate(alloc, this, 1);
+    }
+
+    union { T m_object; };
+};
+
+#include <vector> // make_shared_batch
+
+template <typename T, typename CountPolicy>
+class weak_ptr;
+
+template <typename T>
+class atomic_shared_ptr;
+
+template <typename T, typename CountPolicy>
+class enable_shared_from_this;
+
+// Trace: where the constructors, the destructor and the copy and move operations report to (trace.h)
+template <typename T, typename CountPolicy = nonatomic_count, typename Trace = pointer_trace<T>>
+class shared_ptr
+{
+public:
+    shared_ptr()
+        : m_data(nullptr), m_ctrl(nullptr)
+    {
+        Trace::record("shared_ptr()");
+    }
+
+    explicit shared_ptr(T* data)
+        : m_data(data), m_ctrl(new pointer_control_block<T, CountPolicy>(data))
+    {
+        Trace::record("explicit shared_ptr(T*)");
+        enable_shared_from(data, m_ctrl);
+    }
+
+    // the object is given to _deleter rather than deleted, when the last owner lets go
+    // (constrained, or it would take over from the private constructor that adopts a control block)
+    template <typename Deleter>
+        requires requires(Deleter& d, T* p) { d(p); }
+    shared_ptr(T* data, Deleter _deleter)
+        : m_data(data), m_ctrl(new pointer_control_block<T, CountPolicy, Deleter>(data, ::move(_deleter)))
+    {
+        Trace::record("shared_ptr(T*, Deleter)");
+        enable_shared_from(data, m_ctrl);
+    }
+
+    // Aliasing: shares the ownership of whatever _owner owns, but points to _data, usually a part of it
+    // (a member, an element). Nothing is allocated, and nobody deletes _data itself.
+    template <typename U, typename R>
+    shared_ptr(const shared_ptr<U, CountPolicy, R>& _owner, T* _data)
+        : m_data(_data), m_ctrl(_owner.m_ctrl)
+    {
+        Trace::record("shared_ptr(const shared_ptr<U>& _owner, T* _data)");
+        if (m_ctrl)
+            m_ctrl->add_ref();
+    }
+
+    ~shared_ptr()
+    {
+        Trace::record("~shared_ptr()");
+        release();
+    }
+
+    shared_ptr(const shared_ptr& _rhs)
+        : m_data(_rhs.m_data), m_ctrl(_rhs.m_ctrl)
+    {
+        Trace::record("shared_ptr(const shared_ptr& _rhs)");
+        if (m_ctrl)
+            m_ctrl->add_ref();
+    }
+
+    shared_ptr(shared_ptr&& _rhs)
+        : m_data(_rhs.m_data), m_ctrl(_rhs.m_ctrl)
+    {
+        Trace::record("shared_ptr(shared_ptr&& _rhs)");
+        _rhs.m_data = nullptr;
+        _rhs.m_ctrl = nullptr;
+    }
+
+    // Take the new reference before dropping the old one, so that self-assignment
+    // (or assigning a handle that is only kept alive by *this) never frees the object under us.
+    shared_ptr& operator=(const shared_ptr& _rhs)
+    {
+        Trace::record("shared_ptr& operator=(const shared_ptr& _rhs)");
+        if (_rhs.m_ctrl)
+            _rhs.m_ctrl->add_ref();
+        release();
+
+        this->m_data = _rhs.m_data;
+        this->m_ctrl = _rhs.m_ctrl;
+
+        return *this;
+    }
+
+    shared_ptr& operator=(shared_ptr&& _rhs)
+    {
+        Trace::record("shared_ptr& operator=(shared_ptr&& _rhs)");
+        if (this == &_rhs)
+            return *this;
+        release();
+
+        this->m_data = _rhs.m_data;
+        this->m_ctrl = _rhs.m_ctrl;
+
+        _rhs.m_data = nullptr;
+        _rhs.m_ctrl = nullptr;
+
+        return *this;
+    }
+
+    T* get() const              { return m_data; } // shallow const, like T* const
+    unsigned use_count() const  { return m_ctrl ? m_ctrl->use_count() : 0; }
+
+    void swap(shared_ptr& _rhs) noexcept
+    {
+        T* data = m_data;
+        control_block<CountPolicy>* ctrl = m_ctrl;
+        m_data = _rhs.m_data;
+        m_ctrl = _rhs.m_ctrl;
+        _rhs.m_data = data;
+        _rhs.m_ctrl = ctrl;
+    }
+
+private:
+    template <typename U, typename C, typename R>
+    friend class shared_ptr;
+
+    friend class weak_ptr<T, CountPolicy>;
+
+    template <typename U>
+    friend class atomic_shared_ptr;
+
+    template <typename U, typename C, typename... Args>
+    friend shared_ptr<U, C> make_shared(Args&&... args);
+
+    template <typename U, typename C, typename Alloc, typename... Args>
+    friend shared_ptr<U, C> allocate_shared(const Alloc& alloc, Args&&... args);
+
+    template <typename U, typename C>
+    friend enable_if_t<not is_unbounded_array_v<U>, shared_ptr<U, C>> make_shared_for_overwrite();
+
+    template <typename U, typename C, typename... Args>
+    friend std::vector<shared_ptr<U, C>> make_shared_batch(size_t n, const Args&... args);
+
+    template <typename U, typename C>
+    friend enable_if_t<is_unbounded_array_v<U>, shared_ptr<remove_extent_t<U>, C>> make_shared_for_overwrite(size_t n);
+
+    // adopts a block that already holds the object and one reference to it
+    shared_ptr(T* data, control_block<CountPolicy>* ctrl)
+        : m_data(data), m_ctrl(ctrl)
+    {}
+
+    // a new object that derives from enable_shared_from_this learns who its first owner is
+    template <typename U>
+    static void enable_shared_from(enable_shared_from_this<U, CountPolicy>* _object, control_block<CountPolicy>* _ctrl)
+    {
+        if (_object && _object->m_weak_this.expired())
+            _object->m_weak_this = weak_ptr<U, CountPolicy>(static_cast<U*>(_object), _ctrl);
+    }
+    static void enable_shared_from(const volatile void*, const void*) {}
+
+    void release()
+    {
+        if (m_ctrl)
+            m_ctrl->release();
+    }
+
+    T* m_data;
+    control_block<CountPolicy>* m_ctrl;
+};
+
+template <typename T, typename CountPolicy = nonatomic_count, typename... Args>
+shared_ptr<T, CountPolicy> make_shared(Args&&... args)
+{
+    auto* ctrl = new inplace_control_block<T, CountPolicy>(::forward<Args>(args)...);
+    shared_ptr<T, CountPolicy>::enable_shared_from(ctrl->get(), ctrl);
+    return shared_ptr<T, CountPolicy>(ctrl->get(), ctrl);
+}
+
+// n handles that look like n make_shared<T>(args...) calls, but all the objects come from a single allocation.
+// The args are not forwarded: every object is constructed from the same (const) arguments.
+template <typename T, typename CountPolicy = nonatomic_count, typename... Args>
+std::vector<shared_ptr<T, CountPolicy>> make_shared_batch(size_t n, const Args&... args)
+{
+    std::vector<shared_ptr<T, CountPolicy>> handles(n); // first, so that nothing is left behind if this throws
+    if (n == 0)
+        return handles;
+
+    auto* blocks = batch_control_block<T, CountPolicy>::create(n, args...);
+    for (size_t i = 0; i < n; ++i)
+    {
+        shared_ptr<T, CountPolicy>::enable_shared_from(blocks[i].get(), &blocks[i]);
+        shared_ptr<T, CountPolicy>(blocks[i].get(), &blocks[i]).swap(handles[i]);
+    }
+    return handles;
+}
+
+// make_shared_for_overwrite: make_shared, but default-initialized (see make_unique_for_overwrite)
+template <typename T, typename CountPolicy = nonatomic_count>
+enable_if_t<not is_unbounded_array_v<T>, shared_ptr<T, CountPolicy>> make_shared_for_overwrite()
+{
+    auto* ctrl = new inplace_control_block<T, CountPolicy>(for_overwrite_t());
+    shared_ptr<T, CountPolicy>::enable_shared_from(ctrl->get(), ctrl);
+    return shared_ptr<T, CountPolicy>(ctrl->get(), ctrl);
+}
+
+// There is no shared_ptr<T[]> here, so the array version hands out a shared_ptr to the first element;
+// the block knows how many elements there are and destroys all of them.
+template <typename T, typename CountPolicy = nonatomic_count>
+enable_if_t<is_unbounded_array_v<T>, shared_ptr<remove_extent_t<T>, CountPolicy>> make_shared_for_overwrite(size_t n)
+{
+    auto* ctrl = array_control_block<remove_extent_t<T>, CountPolicy>::create(n);
+    return shared_ptr<remove_extent_t<T>, CountPolicy>(ctrl->get(), ctrl);
+}
+
+template <typename T, typename CountPolicy = nonatomic_count, typename Alloc, typename... Args>
+shared_ptr<T, CountPolicy> allocate_shared(const Alloc& alloc, Args&&... args)
+{
+    using block = allocator_control_block<T, CountPolicy, rebind_alloc_t<Alloc, T>>;
+    using traits = std::allocator_traits<rebind_alloc_t<Alloc, block>>;
+
+    rebind_alloc_t<Alloc, block> block_alloc(alloc);
+    block* ctrl = traits::allocate(block_alloc, 1);
+    try
+    {
+        ::new (static_cast<void*>(ctrl)) block(rebind_alloc_t<Alloc, T>(alloc), ::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        traits::deallocate(block_alloc, ctrl, 1);
+        throw;
+    }
+    shared_ptr<T, CountPolicy>::enable_shared_from(ctrl->get(), ctrl);
+    return shared_ptr<T, CountPolicy>(ctrl->get(), ctrl);
+}
+
+// Non-owning handle to an object owned by shared_ptrs.
+// It keeps the control block alive (so that it can tell whether the object is gone), but not the object.
+template <typename T, typename CountPolicy = nonatomic_count>
+class weak_ptr
+{
+public:
+    weak_ptr()
+        : m_data(nullptr), m_ctrl(nullptr)
+    {}
+
+    template <typename Trace>
+    weak_ptr(const shared_ptr<T, CountPolicy, Trace>& _rhs)
+        : m_data(_rhs.m_data), m_ctrl(_rhs.m_ctrl)
+    {
+        if (m_ctrl)
+            m_ctrl->add_weak_ref();
+    }
+
+    ~weak_ptr()
+    {
+        release();
+    }
+
+    weak_ptr(const weak_ptr& _rhs)
+        : m_data(_rhs.m_data), m_ctrl(_rhs.m_ctrl)
+    {
+        if (m_ctrl)
+            m_ctrl->add_weak_ref();
+    }
+
+    weak_ptr(weak_ptr&& _rhs) noexcept
+        : m_data(_rhs.m_data), m_ctrl(_rhs.m_ctrl)
+    {
+        _rhs.m_data = nullptr;
+        _rhs.m_ctrl = nullptr;
+    }
+
+    weak_ptr& operator=(const weak_ptr& _rhs)
+    {
+        if (_rhs.m_ctrl)
+            _rhs.m_ctrl->add_weak_ref();
+        release();
+
+        this->m_data = _rhs.m_data;
+        this->m_ctrl = _rhs.m_ctrl;
+
+        return *this;
+    }
+
+    weak_ptr& operator=(weak_ptr&& _rhs) noexcept
+    {
+        if (this == &_rhs)
+            return *this;
+        release();
+
+        this->m_data = _rhs.m_data;
+        this->m_ctrl = _rhs.m_ctrl;
+
+        _rhs.m_data = nullptr;
+        _rhs.m_ctrl = nullptr;
+
+        return *this;
+    }
+
+    unsigned use_count() const  { return m_ctrl ? m_ctrl->use_count() : 0; }
+    bool expired() const        { return use_count() == 0; }
+
+    // An empty shared_ptr if the object is already gone.
+    // We cannot just read the count and then copy: the last owner may drop it in between,
+    // so the count is only bumped if it is still nonzero at that very moment.
+    shared_ptr<T, CountPolicy> lock() const
+    {
+        if (m_ctrl && m_ctrl->add_ref_if_alive())
+            return shared_ptr<T, CountPolicy>(m_data, m_ctrl);
+        return shared_ptr<T, CountPolicy>();
+    }
+
+private:
+    template <typename U, typename C, typename R>
+    friend class shared_ptr;
+
+    // takes a new weak reference on a block that has no shared_ptr to hand yet (enable_shared_from_this)
+    weak_ptr(T* _data, control_block<CountPolicy>* _ctrl)
+        : m_data(_data), m_ctrl(_ctrl)
+    {
+        m_ctrl->add_weak_ref();
+    }
+
+    void release()
+    {
+        if (m_ctrl)
+            m_ctrl->release_weak();
+    }
+
+    T* m_data;
+    control_block<CountPolicy>* m_ctrl;
+};
+
+// Lets an object make shared_ptrs to itself that share the ownership of the shared_ptr it is already owned by,
+// where shared_ptr<T>(this) would make a second control block and delete the object twice.
+// The first shared_ptr of the object (shared_ptr(T*), make_shared or allocate_shared) fills in a weak_ptr to itself.
+template <typename T, typename CountPolicy = nonatomic_count>
+class enable_shared_from_this
+{
+public:
+    // throws std::bad_weak_ptr if the object is not owned by a shared_ptr (any more)
+    shared_ptr<T, CountPolicy> shared_from_this()
+    {
+        if (m_weak_this.expired())
+            throw std::bad_weak_ptr();
+        return m_weak_this.lock();
+    }
+
+    shared_ptr<const T, CountPolicy> shared_from_this() const
+    {
+        return shared_ptr<const T, CountPolicy>(const_cast<enable_shared_from_this*>(this)->shared_from_this(),
+                                                static_cast<const T*>(this));
+    }
+
+    weak_ptr<T, CountPolicy> weak_from_this() const { return m_weak_this; }
+
+protected:
+    enable_shared_from_this()   = default;
+    ~enable_shared_from_this()  = default;
+
+    // a copy is a new object, which is not owned by the shared_ptrs of the original
+    enable_shared_from_this(const enable_shared_from_this&)             {}
+    enable_shared_from_this& operator=(const enable_shared_from_this&)  { return *this; }
+
+private:
+    template <typename U, typename C, typename R>
+    friend class shared_ptr;
+
+    mutable weak_ptr<T, CountPolicy> m_weak_this;
+};
+
+#include <cassert>
+#include <cstdint>
+
+// A shared_ptr<T, atomic_count> that many threads may load and replace at the same time, without locks.
+//
+// Copying a shared_ptr out of a shared location is the hard part: between reading the control block pointer and
+// incrementing its count, another thread may replace the pointer and drop the last reference, freeing the block.
+// So the count is split in two (split reference counting):
+// - the word holds the block pointer in its low 48 bits (user space addresses on x86-64 and AArch64 fit)
+//   and, in its top 16 bits, a local count of the readers that are between reading the pointer and taking a reference
+// - the atomic itself owns one ordinary reference on the block
+// load():    1. bumps the local count together with reading the pointer, in one fetch_add
+//            2. takes an ordinary reference on the block
+//            3. takes its local count back, or, if the pointer has been replaced in the meantime,
+//               drops the extra reference that the replacing thread added on its behalf
+// replacing: swaps the word, then adds one reference per local count that came out with the old pointer
+//            before it gives up the atomic's own reference
+// Readers never wait for each other or for writers, a failed CAS only means that somebody else made progress.
+//
+// The block only knows the address of the object it manages, so handles made with the aliasing constructor
+// cannot be stored: the pointer they hold would be lost (asserted in debug builds).
+template <typename T>
+class atomic_shared_ptr
+{
+    using handle = shared_ptr<T, atomic_count>;
+    using block = control_block<atomic_count>;
+
+    static_assert(sizeof(uintptr_t) == 8, "the local count lives in the unused top bits of a 64-bit pointer");
+
+    static constexpr unsigned pointer_bits  = 48;
+    static constexpr uintptr_t one_reader   = uintptr_t(1) << pointer_bits;
+    static constexpr uintptr_t pointer_mask = one_reader - 1;
+
+public:
+    atomic_shared_ptr()
+        : m_word(0)
+    {}
+
+    explicit atomic_shared_ptr(handle desired)
+        : m_word(steal(desired))
+    {}
+
+    ~atomic_shared_ptr()
+    {
+        adopt(m_word.load(std::memory_order_acquire)); // nobody may be reading any more, so there is nothing to cover
+    }
+
+    atomic_shared_ptr(const atomic_shared_ptr&)             = delete;
+    atomic_shared_ptr& operator=(const atomic_shared_ptr&)  = delete;
+
+    handle load() const
+    {
+        uintptr_t word = m_word.fetch_add(one_reader, std::memory_order_acquire);
+        block* ctrl = to_block(word);
+        if (ctrl)
+            ctrl->add_ref();
+
+        uintptr_t expected = word + one_reader;
+        while (not m_word.compare_exchange_weak(expected, expected - one_reader, std::memory_order_relaxed))
+        {
+            if (to_block(expected) != ctrl || not (expected >> pointer_bits))
+            {
+                // the pointer was replaced (maybe even by itself again): the local count we added went away
+                // with it and was turned into an ordinary reference for us, which we do not need
+                if (ctrl)
+                    ctrl->release();
+                break;
+            }
+        }
+
+        return make_handle(ctrl);
+    }
+
+    void store(handle desired)
+    {
+        adopt(m_word.exchange(steal(desired), std::memory_order_acq_rel));
+    }
+
+    handle exchange(handle desired)
+    {
+        return adopt(m_word.exchange(steal(desired), std::memory_order_acq_rel));
+    }
+
+    // Replaces the pointer if it is still the one held by `expected`, otherwise loads the current one into `expected`.
+    bool compare_exchange_strong(handle& expected, handle desired)
+    {
+        return compare_exchange(expected, desired);
+    }
+
+    bool compare_exchange_weak(handle& expected, handle desired)
+    {
+        return compare_exchange(expected, desired);
+    }
+
+    static constexpr bool is_always_lock_free = std::atomic<uintptr_t>::is_always_lock_free;
+
+private:
+    bool compare_exchange(handle& expected, handle& desired)
+    {
+        const uintptr_t desired_word = steal(desired);
+
+        uintptr_t word = m_word.load(std::memory_order_relaxed);
+        while (to_block(word) == expected.m_ctrl)
+        {
+            if (m_word.compare_exchange_weak(word, desired_word, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                adopt(word);
+                return true;
+            }
+        }
+
+        desired.m_ctrl = to_block(desired_word); // give the reference back to `desired`, which drops it
+        desired.m_data = desired.m_ctrl ? static_cast<T*>(desired.m_ctrl->object()) : nullptr;
+        expected = load();
+        return false;
+    }
+
+    static block* to_block(uintptr_t word) { return reinterpret_cast<block*>(word & pointer_mask); }
+
+    static handle make_handle(block* ctrl)
+    {
+        return handle(ctrl ? static_cast<T*>(ctrl->object()) : nullptr, ctrl);
+    }
+
+    // the atomic takes over the reference of `desired`
+    static uintptr_t steal(handle& desired)
+    {
+        assert(desired.m_data == (desired.m_ctrl ? desired.m_ctrl->object() : nullptr) && "aliasing handles cannot be stored");
+        const uintptr_t word = reinterpret_cast<uintptr_t>(desired.m_ctrl);
+        desired.m_data = nullptr;
+        desired.m_ctrl = nullptr;
+        return word;
+    }
+
+    // the atomic's reference on a block that was just swapped out, after adding one for each reader still counted locally
+    static handle adopt(uintptr_t word)
+    {
+        block* ctrl = to_block(word);
+        if (ctrl)
+            for (uintptr_t readers = word >> pointer_bits; readers; --readers)
+                ctrl->add_ref();
+        return make_handle(ctrl);
+    }
+
+    mutable std::atomic<uintptr_t> m_word;
+};
+
+#include <algorithm>
+#include <stdexcept>
+
+// Safe memory reclamation for lock-free structures (hazard pointers, Maged Michael 2004).
+//
+// A reader announces the node it is about to dereference in one of the domain's hazard slots (protect());
+// a writer that unlinked a node hands it to retire() instead of deleting it.
+// Retired nodes are collected, and once there are twice as many of them as there are slots,
+// the retiring thread scans the slots once and deletes every node that nobody announced.
+// At most max_hazard_pointers of them can survive a scan, so every scan frees at least as many nodes as there are
+// slots: the scan cost is amortized over the retires, and memory held back is bounded by 2 * max_hazard_pointers nodes.
+class hazard_pointer_domain
+{
+    struct alignas(64) slot // one cache line per slot, readers of different slots do not disturb each other
+    {
+        std::atomic<const void*> pointer{nullptr};
+        std::atomic<bool> in_use{false};
+    };
+
+    struct retired
+    {
+        void* pointer;
+        void (*deleter)(void*);
+        retired* next;
+    };
+
+public:
+    static constexpr unsigned max_hazard_pointers   = 64;
+    static constexpr unsigned retire_threshold      = 2 * max_hazard_pointers;
+
+    // Owns one slot of the domain. Meant to be kept by a thread and reused for every protect(), acquiring is a scan.
+    class hazard_pointer
+    {
+    public:
+        hazard_pointer()
+            : m_slot(nullptr)
+        {}
+
+        ~hazard_pointer()
+        {
+            if (m_slot)
+            {
+                reset();
+                m_slot->in_use.store(false, std::memory_order_release);
+            }
+        }
+
+        hazard_pointer(hazard_pointer&& _rhs) noexcept
+            : m_slot(_rhs.m_slot)
+        {
+            _rhs.m_slot = nullptr;
+        }
+
+        hazard_pointer(const hazard_pointer&)               = delete;
+        hazard_pointer& operator=(const hazard_pointer&)    = delete;
+        hazard_pointer& operator=(hazard_pointer&&)         = delete;
+
+        // Returns what src points to, which stays alive until reset() or the next protect().
+        // Announcing is not enough on its own: the node may have been retired (and scanned) before our announcement
+        // became visible, so we read src again after announcing and start over if it has changed.
+        template <typename T>
+        T* protect(const std::atomic<T*>& src)
+        {
+            T* ptr = src.load(std::memory_order_relaxed);
+            while (true)
+            {
+                m_slot->pointer.store(ptr, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in reclaim()
+
+                T* again = src.load(std::memory_order_acquire);
+                if (again == ptr)
+                    return ptr;
+                ptr = again;
+            }
+        }
+
+        void reset()                { m_slot->pointer.store(nullptr, std::memory_order_release); }
+
+    private:
+        friend class hazard_pointer_domain;
+
+        explicit hazard_pointer(slot* _slot)
+            : m_slot(_slot)
+        {}
+
+        slot* m_slot;
+    };
+
+    hazard_pointer_domain()
+        : m_retired(nullptr), m_retired_count(0)
+    {}
+
+    // every reader is gone by now, so whatever is left can go
+    ~hazard_pointer_domain()
+    {
+        free(m_retired.exchange(nullptr), nullptr, 0);
+    }
+
+    hazard_pointer_domain(const hazard_pointer_domain&)             = delete;
+    hazard_pointer_domain& operator=(const hazard_pointer_domain&)  = delete;
+
+    hazard_pointer make_hazard_pointer()
+    {
+        for (slot& s : m_slots)
+        {
+            bool in_use = false;
+            if (not s.in_use.load(std::memory_order_relaxed)
+                && s.in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+                return hazard_pointer(&s);
+        }
+        throw std::length_error("hazard_pointer_domain: all hazard pointers are in use");
+    }
+
+    // ptr must already be unreachable for readers that have not protected it yet.
+    // Only the pointer is kept, so the deleter has to be stateless.
+    template <typename T, typename Deleter>
+    void retire(unique_ptr<T, Deleter>&& ptr)
+    {
+        static_assert(__is_empty(Deleter), "retire() keeps the pointer only, the deleter must be stateless");
+
+        T* raw = ptr.release();
+        if (not raw)
+            return;
+
+        retired* node = new retired{raw, [](void* p) { Deleter()(static_cast<T*>(p)); }, nullptr};
+        push(node, node);
+
+        if (m_retired_count.fetch_add(1, std::memory_order_relaxed) + 1 >= retire_threshold)
+            reclaim();
+    }
+
+    // Deletes every retired node that is not protected right now.
+    void reclaim()
+    {
+        retired* list = m_retired.exchange(nullptr, std::memory_order_acquire);
+        if (not list)
+            return;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in protect()
+
+        const void* hazards[max_hazard_pointers];
+        unsigned n_hazards = 0;
+        for (const slot& s : m_slots)
+            if (const void* ptr = s.pointer.load(std::memory_order_acquire))
+                hazards[n_hazards++] = ptr;
+        std::sort(hazards, hazards + n_hazards);
+
+        free(list, hazards, n_hazards);
+    }
+
+    unsigned retired_count() const  { return m_retired_count.load(std::memory_order_relaxed); }
+
+private:
+    // puts the chain first..last back onto the retired list
+    void push(retired* first, retired* last)
+    {
+        last->next = m_retired.load(std::memory_order_relaxed);
+        while (not m_retired.compare_exchange_weak(last->next, first, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    // deletes the nodes of list that are not in the sorted hazards array, and retires the rest again
+    void free(retired* list, const void* const* hazards, unsigned n_hazards)
+    {
+        retired* kept_first = nullptr;
+        retired* kept_last = nullptr;
+        unsigned freed = 0;
+
+        while (list)
+        {
+            retired* next = list->next;
+            if (std::binary_search(hazards, hazards + n_hazards, static_cast<const void*>(list->pointer)))
+            {
+                list->next = kept_first;
+                kept_first = list;
+                if (not kept_last)
+                    kept_last = list;
+            }
+            else
+            {
+                list->deleter(list->pointer);
+                delete list;
+                ++freed;
+            }
+            list = next;
+        }
+
+        m_retired_count.fetch_sub(freed, std::memory_order_relaxed);
+        if (kept_first)
+            push(kept_first, kept_last);
+    }
+
+    slot m_slots[max_hazard_pointers];
+    std::atomic<retired*> m_retired;
+    std::atomic<unsigned> m_retired_count;
+};
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Takes destruction off the threads that let go of objects: retire() only queues the pointer,
+// and a background thread destroys and frees what has piled up, a batch at a time.
+// - the queue holds at most max_depth objects: a thread retiring into a full queue destroys its object itself,
+//   so memory stays bounded when the reclaimer falls behind (at the price of that thread's latency)
+// - a smaller batch is due, too, once max_delay has passed, so that a few stragglers do not wait forever
+// - drain() destroys everything retired so far before it returns, on the calling thread; the destructor drains, too
+// Use it through deferred_delete, the deleter of unique_ptr and shared_ptr(T*, D) below.
+class deferred_reclaimer
+{
+    struct retired
+    {
+        void* pointer;
+        void (*deleter)(void*);
+    };
+
+public:
+    explicit deferred_reclaimer(size_t _max_depth = 65536, size_t _batch = 256,
+                                std::chrono::milliseconds _max_delay = std::chrono::milliseconds(10))
+        : m_max_depth(_max_depth), m_batch(_batch), m_max_delay(_max_delay), m_busy(false), m_stop(false), m_inline(0),
+          m_thread([this] { run(); })
+    {}
+
+    ~deferred_reclaimer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+        drain();
+    }
+
+    deferred_reclaimer(const deferred_reclaimer&)               = delete;
+    deferred_reclaimer& operator=(const deferred_reclaimer&)    = delete;
+
+    // Only the pointer is queued, so the deleter has to be stateless.
+    template <typename T, typename Deleter = default_delete<T>>
+    void retire(T* ptr)
+    {
+        static_assert(__is_empty(Deleter), "retire() keeps the pointer only, the deleter must be stateless");
+        if (not ptr)
+            return;
+
+        size_t depth;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            depth = m_queue.size();
+            if (depth < m_max_depth)
+                m_queue.push_back({ptr, [](void* p) { Deleter()(static_cast<T*>(p)); }});
+        }
+
+        if (depth >= m_max_depth)
+        {
+            m_inline.fetch_add(1, std::memory_order_relaxed);
+            Deleter()(ptr);
+        }
+        else if (depth + 1 == m_batch)
+            m_wake.notify_one();
+    }
+
+    // Destroys everything retired before the call, including a batch the reclaimer is working on right now.
+    void drain()
+    {
+        std::vector<retired> batch;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_idle.wait(lock, [this] { return not m_busy; });
+            batch.swap(m_queue);
+        }
+        destroy(batch);
+    }
+
+    size_t queued() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queue.size();
+    }
+
+    // how many objects were destroyed by the retiring thread because the queue was full
+    size_t destroyed_inline() const     { return m_inline.load(std::memory_order_relaxed); }
+
+private:
+    void run()
+    {
+        std::vector<retired> batch;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (not m_stop)
+        {
+            m_wake.wait_for(lock, m_max_delay, [this] { return m_stop || m_queue.size() >= m_batch; });
+            if (m_queue.empty())
+                continue;
+
+            batch.swap(m_queue);
+            m_busy = true;
+            lock.unlock();
+
+            destroy(batch); // leaves batch empty, with its capacity kept for the next swap
+
+            lock.lock();
+            m_busy = false;
+            m_idle.notify_all();
+        }
+    }
+
+    static void destroy(std::vector<retired>& _batch)
+    {
+        for (const retired& r : _batch)
+            r.deleter(r.pointer);
+        _batch.clear();
+    }
+
+    const size_t m_max_depth;
+    const size_t m_batch;
+    const std::chrono::milliseconds m_max_delay;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;     // the reclaimer waits for work
+    std::condition_variable m_idle;     // drain() waits for the reclaimer's batch
+    std::vector<retired> m_queue;
+    bool m_busy;
+    bool m_stop;
+    std::atomic<size_t> m_inline;
+
+    std::thread m_thread;               // last, it starts running as soon as it is constructed
+};
+
+// Deleter that hands the object to a deferred_reclaimer instead of deleting it.
+template <typename T>
+class deferred_delete
+{
+public:
+    // no default: a deleter without a reclaimer could only crash on the first delete
+    deferred_delete()                   = delete;
+
+    explicit deferred_delete(deferred_reclaimer& _reclaimer)
+        : m_reclaimer(&_reclaimer)
+    {}
+
+    void operator()(T* ptr) const       { m_reclaimer->retire(ptr); }
+
+private:
+    deferred_reclaimer* m_reclaimer;
+};
+
+// CRTP base for types that carry their own reference count.
+// intrusive_ptr finds the two hooks below by argument dependent lookup, so any type may provide its own instead.
+template <typename Derived, typename CountPolicy = nonatomic_count>
+class intrusive_ref_counter
+{
+public:
+    unsigned use_count() const  { return m_uses.load(); }
+
+protected:
+    intrusive_ref_counter()
+        : m_uses(0)
+    {
+        on_zero();
+    }
+
+    // a copy is a new object, nobody owns it yet
+    intrusive_ref_counter(const intrusive_ref_counter&)
+        : m_uses(0)
+    {
+        on_zero();
+    }
+    intrusive_ref_counter& operator=(const intrusive_ref_counter&)  { return *this; }
+
+    ~intrusive_ref_counter()    = default;
+
+private:
+    friend void intrusive_ptr_add_ref(const intrusive_ref_counter* ptr)
+    {
+        ptr->m_uses.increment();
+    }
+
+    friend void intrusive_ptr_release(const intrusive_ref_counter* ptr)
+    {
+        if (ptr->m_uses.decrement())
+            destroy(ptr);
+    }
+
+    // Out of line: dropping the last reference is the rare path. Inlined, it also made GCC warn (-Wuse-after-free)
+    // wherever two handles to one object are released in a row, as if the first one could have deleted it.
+    [[gnu::cold, gnu::noinline]] static void destroy(const intrusive_ref_counter* ptr)
+    {
+        delete static_cast<const Derived*>(ptr);
+    }
+
+    // biased_count may drop to zero outside of intrusive_ptr_release(), when its owner merges it (see control_block)
+    void on_zero()
+    {
+        if constexpr (requires { m_uses.on_zero(nullptr, nullptr); })
+            m_uses.on_zero([](void* self) { destroy(static_cast<const intrusive_ref_counter*>(self)); }, this);
+    }
+
+    mutable CountPolicy m_uses;
+};
+
+// Shared ownership without a control block: the count lives in the object, so the handle is one pointer wide
+template <typename T>
+class intrusive_ptr
+{
+public:
+    intrusive_ptr()
+        : m_data(nullptr)
+    {}
+
+    explicit intrusive_ptr(T* data)
+        : m_data(data)
+    {
+        if (m_data)
+            intrusive_ptr_add_ref(m_data);
+    }
+
+    ~intrusive_ptr()
+    {
+        release();
+    }
+
+    intrusive_ptr(const intrusive_ptr& _rhs)
+        : m_data(_rhs.m_data)
+    {
+        if (m_data)
+            intrusive_ptr_add_ref(m_data);
+    }
+
+    intrusive_ptr(intrusive_ptr&& _rhs) noexcept
+        : m_data(_rhs.m_data)
+    {
+        _rhs.m_data = nullptr;
+    }
+
+    intrusive_ptr& operator=(const intrusive_ptr& _rhs)
+    {
+        if (_rhs.m_data)
+            intrusive_ptr_add_ref(_rhs.m_data);
+        release();
+
+        this->m_data = _rhs.m_data;
+
+        return *this;
+    }
+
+    intrusive_ptr& operator=(intrusive_ptr&& _rhs) noexcept
+    {
+        if (this == &_rhs)
+            return *this;
+        release();
+
+        this->m_data = _rhs.m_data;
+        _rhs.m_data = nullptr;
+
+        return *this;
+    }
+
+    T* get() const              { return m_data; }
+    unsigned use_count() const  { return m_data ? m_data->use_count() : 0; }
+
+    void swap(intrusive_ptr& _rhs) noexcept
+    {
+        T* data = m_data;
+        m_data = _rhs.m_data;
+        _rhs.m_data = data;
+    }
+
+private:
+    void release()
+    {
+        if (m_data)
+            intrusive_ptr_release(m_data);
+    }
+
+    T* m_data;
+};
+
+template <typename T, typename... Args>
+intrusive_ptr<T> make_intrusive(Args&&... args)
+{
+    return intrusive_ptr<T>(new T(::forward<Args>(args)...));
+}
+
+// S<T> that can be owned by intrusive_ptr
+template <typename T, typename CountPolicy = nonatomic_count>
+struct CountedS : S<T>, intrusive_ref_counter<CountedS<T, CountPolicy>, CountPolicy> {
+    using S<T>::S;
+};
+
+// The layout of make_shared without the second pointer: the handle points at the block, and the object is found
+// at a fixed offset in it. Like intrusive_ptr the handle is one pointer wide, but T does not have to know about it.
+// What it gives up: there is no aliasing, no conversion to a base class (the offset belongs to T), no weak_ptr,
+// and no adopting an object that was allocated elsewhere.
+template <typename T, typename CountPolicy = nonatomic_count>
+class compact_shared_ptr
+{
+    struct block {
+        template <typename... Args>
+        explicit block(Args&&... args)
+            : uses(1), object(::forward<Args>(args)...)
+        {
+            // biased_count may drop to zero outside of release(), when its owner merges it (see control_block)
+            if constexpr (requires { uses.on_zero(nullptr, nullptr); })
+                uses.on_zero([](void* self) { destroy(static_cast<block*>(self)); }, this);
+        }
+
+        CountPolicy uses;
+        T object;
+    };
+
+public:
+    compact_shared_ptr()
+        : m_block(nullptr)
+    {}
+
+    ~compact_shared_ptr()
+    {
+        release();
+    }
+
+    compact_shared_ptr(const compact_shared_ptr& _rhs)
+        : m_block(_rhs.m_block)
+    {
+        if (m_block)
+            m_block->uses.increment();
+    }
+
+    compact_shared_ptr(compact_shared_ptr&& _rhs) noexcept
+        : m_block(_rhs.m_block)
+    {
+        _rhs.m_block = nullptr;
+    }
+
+    compact_shared_ptr& operator=(const compact_shared_ptr& _rhs)
+    {
+        if (_rhs.m_block)
+            _rhs.m_block->uses.increment();
+        release();
+
+        this->m_block = _rhs.m_block;
+
+        return *this;
+    }
+
+    compact_shared_ptr& operator=(compact_shared_ptr&& _rhs) noexcept
+    {
+        if (this == &_rhs)
+            return *this;
+        release();
+
+        this->m_block = _rhs.m_block;
+        _rhs.m_block = nullptr;
+
+        return *this;
+    }
+
+    T* get() const              { return m_block ? &m_block->object : nullptr; }
+    unsigned use_count() const  { return m_block ? m_block->uses.load() : 0; }
+
+    void swap(compact_shared_ptr& _rhs) noexcept
+    {
+        block* tmp = m_block;
+        m_block = _rhs.m_block;
+        _rhs.m_block = tmp;
+    }
+
+private:
+    template <typename U, typename C, typename... Args>
+    friend compact_shared_ptr<U, C> make_compact_shared(Args&&... args);
+
+    explicit compact_shared_ptr(block* _block)
+        : m_block(_block)
+    {}
+
+    void release()
+    {
+        if (m_block && m_block->uses.decrement())
+            destroy(m_block);
+    }
+
+    // out of line, as intrusive_ptr_release() does it
+    [[gnu::cold, gnu::noinline]] static void destroy(block* _block)
+    {
+        delete _block;
+    }
+
+    block* m_block;
+};
+
+template <typename T, typename CountPolicy = nonatomic_count, typename... Args>
+compact_shared_ptr<T, CountPolicy> make_compact_shared(Args&&... args)
+{
+    using block = typename compact_shared_ptr<T, CountPolicy>::block;
+    return compact_shared_ptr<T, CountPolicy>(new block(::forward<Args>(args)...));
+}
+
+// A table that owns its objects and hands out handles instead of counted pointers: a handle is a slot index and
+// the generation of the slot when the object was put there. Erasing bumps the generation, so a stale handle no
+// longer matches and get() returns nullptr instead of somebody else's object. Nothing is counted, ever:
+// a lookup is a bounds check, a comparison and an address computation.
+// The slots live in pages that never move, so T needs neither a copy nor a move (S<T> has neither), pointers stay
+// valid until the object is erased, and freed slots are reused first, which keeps the live objects packed.
+// A slot whose generation would wrap around (after 2^31 objects) is retired rather than reused: its next object
+// would get generation 1 again, and the handle of its very first object would match it.
+struct slot_handle {
+    uint32_t index;
+    uint32_t generation;     // odd: see slot_map::slot
+};
+
+template <typename T, size_t PageSize = 1024>
+class slot_map
+{
+    struct slot {
+        slot()
+            : generation(0), next_free(0)
+        {}
+        ~slot() {} // the map destroys the object, if there is one
+
+        union { T object; };
+        uint32_t generation;    // odd while the slot holds an object, bumped at every emplace and erase
+        uint32_t next_free;     // only meaningful while the slot is free
+    };
+
+public:
+    slot_map()
+        : m_size(0), m_slots(0), m_free(no_slot)
+    {}
+
+    ~slot_map()
+    {
+        for (uint32_t i = 0; i < m_slots; ++i)
+            if (at(i).generation & 1)
+                at(i).object.~T();
+    }
+
+    slot_map(const slot_map&)               = delete;
+    slot_map& operator=(const slot_map&)    = delete;
+
+    // constructs the object in place, like make_shared
+    template <typename... Args>
+    slot_handle emplace(Args&&... args)
+    {
+        uint32_t index = m_free;
+        if (index == no_slot)
+        {
+            if (m_slots % PageSize == 0)
+                m_pages.push_back(make_unique<slot[]>(PageSize));
+            index = m_slots;
+        }
+
+        slot& s = at(index);
+        ::new (static_cast<void*>(&s.object)) T(::forward<Args>(args)...);
+
+        if (index == m_free)
+            m_free = s.next_free;
+        else
+            ++m_slots;
+        ++s.generation;
+        ++m_size;
+        return {index, s.generation};
+    }
+
+    // nullptr if the handle is stale (its object was erased) or was never handed out by this map
+    T* get(slot_handle _handle)
+    {
+        if (_handle.index >= m_slots)
+            return nullptr;
+        slot& s = at(_handle.index);
+        return s.generation == _handle.generation && (_handle.generation & 1) ? &s.object : nullptr;
+    }
+    const T* get(slot_handle _handle) const
+    {
+        if (_handle.index >= m_slots)
+            return nullptr;
+        const slot& s = at(_handle.index);
+        return s.generation == _handle.generation && (_handle.generation & 1) ? &s.object : nullptr;
+    }
+
+    bool erase(slot_handle _handle)
+    {
+        T* object = get(_handle);
+        if (not object)
+            return false;
+
+        object->~T();
+        slot& s = at(_handle.index);
+        if (++s.generation != 0) // 0: wrapped around, the slot is retired (see above)
+        {
+            s.next_free = m_free;
+            m_free = _handle.index;
+        }
+        --m_size;
+        return true;
+    }
+
+    size_t size() const         { return m_size; }
+
+    template <typename Function>
+    void for_each(Function _function)
+    {
+        for (uint32_t i = 0; i < m_slots; ++i)
+            if (at(i).generation & 1)
+                _function(at(i).object);
+    }
+
+private:
+    static constexpr uint32_t no_slot = ~uint32_t(0);
+
+    slot& at(uint32_t _index)               { return m_pages[_index / PageSize][_index % PageSize]; }
+    const slot& at(uint32_t _index) const   { return m_pages[_index / PageSize][_index % PageSize]; }
+
+    std::vector<unique_ptr<slot[]>> m_pages;
+    size_t m_size;
+    uint32_t m_slots;   // slots ever used, free or not
+    uint32_t m_free;    // head of the free list
+};
+
+namespace test_intrusive_ptr_size {
+    static_assert(sizeof(intrusive_ptr<CountedS<Int>>) == sizeof(CountedS<Int>*));
+    static_assert(sizeof(shared_ptr<S<Int>>) == 2 * sizeof(S<Int>*));
+    static_assert(sizeof(compact_shared_ptr<S<Int>>) == sizeof(S<Int>*));
+    static_assert(sizeof(slot_handle) == sizeof(uint64_t));
+}
+
+#include <iostream>
+
+struct uptr_tag {};
+struct sptr_tag {};
+
+template <typename T>
+void print_helper(uptr_tag, const S<T>* const ptr)
+{
+    printf("%p", ptr);
+    if (ptr)
+        std::cout << " [" << ptr->name() << "](" << ptr->get() << ")\n";
+    else
+        std::cout << "\n";
+}
+
+template <typename T>
+void print_helper(sptr_tag, T&& ptr)
+{
+    printf("%p", ptr.get());
+    if (ptr.get())
+        std::cout << " [" << ptr.get()->name() << "](" << ptr.get()->get() << ") count:" << ptr.use_count() << "\n";
+    else
+        std::cout << "\n";
+}
+
+template <typename PtrT, typename T, typename... Ts>
+void _print(PtrT t, T&& arg, Ts&&... args)
+{
+    print_helper(t, forward<T>(arg));
+    if constexpr(sizeof...(args) > 0)
+        _print(t, forward<Ts>(args)...);
+}
+
+template <typename PtrT, typename... Ts>
+void print(PtrT t, Ts&&... args)
+{
+    default_trace::dump(); // what happened since the last print
+    std::cout << "\n";
+    _print(t, forward<Ts>(args)...);
+    std::cout << "\n";
+}
+
+// Hands out single objects from a per-thread list of freed blocks and only goes to operator new when the list is empty.
+// The list is shared by every free_list_allocator<T> of the thread, so the allocator itself is stateless,
+// and memory freed on another thread simply joins that thread's list.
+template <typename T>
+class free_list_allocator
+{
+    struct node { node* next; };
+
+    struct free_list
+    {
+        ~free_list()
+        {
+            while (head)
+                ::operator delete(exchange_head(head->next));
+        }
+
+        node* exchange_head(node* next) { node* ret = head; head = next; return ret; }
+
+        node* head = nullptr;
+    };
+
+    static constexpr size_t block_size = sizeof(T) < sizeof(node) ? sizeof(node) : sizeof(T);
+
+    inline static thread_local free_list s_free;
+
+public:
+    using value_type = T;
+
+    free_list_allocator() = default;
+    template <typename U>
+    free_list_allocator(const free_list_allocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1 && s_free.head)
+            return reinterpret_cast<T*>(s_free.exchange_head(s_free.head->next));
+        return static_cast<T*>(::operator new(n == 1 ? block_size : n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n)
+    {
+        if (n != 1)
+            return ::operator delete(ptr);
+
+        node* freed = reinterpret_cast<node*>(ptr);
+        freed->next = s_free.exchange_head(freed);
+    }
+
+    friend bool operator==(const free_list_allocator&, const free_list_allocator&) { return true; }
+    friend bool operator!=(const free_list_allocator&, const free_list_allocator&) { return false; }
+};
+
+void test_unique_ptr()
+{
+    unique_ptr<S<Int>> uptr1{new S("uptr1", Int{1})};
+    print(uptr_tag{}, uptr1.get());
+
+    auto uptr2 = make_unique<S<Int>>("uptr2", Int{2});
+    print(uptr_tag{}, uptr1.get(), uptr2.get());
+
+    unique_ptr<S<Int>> uptr3;
+    {
+        Int tmp{3};
+        uptr3 = make_unique<S<Int>>("uptr3", tmp);
+    }
+    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get());
+
+    uptr1 = move(uptr2);
+    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get());
+
+    auto uptr4(move(uptr3));
+    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get(), uptr4.get());
+
+    uptr1 = move(uptr1);
+    print(uptr_tag{}, uptr1.get(), uptr2.get(), uptr3.get(), uptr4.get());
+}
+
+struct verbose_delete {
+    template <typename T>
+    void operator()(T* ptr) const { puts("verbose_delete"); delete ptr; }
+};
+
+void test_unique_ptr_deleter()
+{
+    unique_ptr<S<Int>, verbose_delete> uptr1{new S("uptr1", Int{1})};
+    print(uptr_tag{}, uptr1.get());
+
+    // a function pointer is a deleter, too, but one that has to be stored
+    unique_ptr<S<Int>, void(*)(S<Int>*)> uptr2{new S("uptr2", Int{2}), [](S<Int>* ptr) { puts("lambda deleter"); delete ptr; }};
+    print(uptr_tag{}, uptr1.get(), uptr2.get());
+
+    auto arr = make_unique<int[]>(5);
+    for (int i = 0; i < 5; ++i)
+        arr[i] += i;
+    for (int i = 0; i < 5; ++i)
+        printf("%d", arr[i]);
+    printf("\n");
+}
+
+struct Cell {
+    Cell()  { default_trace::record("Cell()"); }
+    ~Cell() { default_trace::record("~Cell()"); }
+};
+
+template <>
+inline constexpr bool traces_lifecycle<Cell> = true;
+
+void test_for_overwrite()
+{
+    // the ints are not initialized, every one of them must be written before it is read
+    auto arr = make_unique_for_overwrite<int[]>(5);
+    for (int i = 0; i < 5; ++i)
+        arr[i] = i;
+    for (int i = 0; i < 5; ++i)
+        printf("%d", arr[i]);
+    printf("\n");
+
+    auto sarr = make_shared_for_overwrite<int[]>(5);
+    for (int i = 0; i < 5; ++i)
+        sarr.get()[i] = 5 - i;
+    auto copy = sarr;
+    for (int i = 0; i < 5; ++i)
+        printf("%d", copy.get()[i]);
+    printf(" use_count: %u\n", copy.use_count());
+
+    // a type with a constructor still gets constructed, and the block destroys every element
+    auto cells = make_shared_for_overwrite<Cell[]>(3);
+}
+
+void test_box()
+{
+    // an Int fits in two pointers: it is constructed right inside the box, and get() points into the box
+    auto box1 = make_box<Int>(1);
+    printf("box1 at %p holds %p\n", static_cast<void*>(&box1), static_cast<void*>(box1.get()));
+
+    // moving the box moves the Int itself (see the trace), and the pointer follows the box
+    auto box2(move(box1));
+    printf("box2 at %p holds %p, box1 holds %p\n", static_cast<void*>(&box2), static_cast<void*>(box2.get()),
+           static_cast<void*>(box1.get()));
+
+    // S would fit as well, but it cannot be moved, so it must stay put: it goes to the heap,
+    // and a move only hands the pointer over
+    auto heap1 = make_box<S<Int>>("heap1", Int{2});
+    auto heap2(move(heap1));
+    print(uptr_tag{}, heap1.get(), heap2.get());
+}
+
+void test_allocate()
+{
+    auto uptr1 = allocate_unique<S<Int>>(free_list_allocator<S<Int>>(), "uptr1", Int{1});
+    print(uptr_tag{}, uptr1.get());
+
+    auto sptr1 = allocate_shared<S<Int>>(free_list_allocator<S<Int>>(), "sptr1", Int{2});
+    print(sptr_tag{}, sptr1);
+
+    uptr1 = unique_ptr<S<Int>, allocator_delete<free_list_allocator<S<Int>>>>(); // the block goes back to the free list...
+    auto uptr2 = allocate_unique<S<Int>>(free_list_allocator<S<Int>>(), "uptr2", Int{3});
+    print(uptr_tag{}, uptr2.get()); // ...and is handed out again
+}
+
+void test_shared_ptr()
+{
+    shared_ptr<S<Int>> sptr1{new S("sptr1", Int{1})};
+    print(sptr_tag{}, sptr1);
+
+    auto sptr2 = make_shared<S<Int>>("sptr2", Int{2});
+    print(sptr_tag{}, sptr1, sptr2);
+
+    shared_ptr<S<Int>> sptr3;
+    {
+        Int tmp{3};
+        sptr3 = make_shared<S<Int>>("sptr3", tmp);
+    }
+    print(sptr_tag{}, sptr1, sptr2, sptr3);
+
+    sptr1 = sptr2;
+    print(sptr_tag{}, sptr1, sptr2, sptr3);
+
+    sptr1 = move(sptr3);
+    print(sptr_tag{}, sptr1, sptr2, sptr3);
+
+    auto sptr4(move(sptr1));
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+
+    sptr3 = sptr4;
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+
+    sptr1 = move(sptr3);
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+
+    sptr1 = move(sptr2);
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+
+    sptr1 = move(sptr4);
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4);
+
+    auto sptr5(sptr1);
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4, sptr5);
+
+    sptr1 = sptr1;
+    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4, sptr5);
+}
+
+void test_weak_ptr()
+{
+    weak_ptr<S<Int>> wptr1;
+    {
+        auto sptr1 = make_shared<S<Int>>("sptr1", Int{1});
+        wptr1 = sptr1;
+        print(sptr_tag{}, sptr1);
+        printf("wptr1 expired: %d, use_count: %u\n", wptr1.expired(), wptr1.use_count());
 
-    sptr1 = sptr1;
-    print(sptr_tag{}, sptr1, sptr2, sptr3, sptr4, sptr5);
+        auto sptr2 = wptr1.lock();
+        print(sptr_tag{}, sptr1, sptr2);
+    } // the object is destroyed here, but the control block lives on for wptr1
+
+    printf("wptr1 expired: %d, use_count: %u\n", wptr1.expired(), wptr1.use_count());
+
+    auto sptr3 = wptr1.lock();
+    print(sptr_tag{}, sptr3);
 }
 
-#include <chrono>
-#include <memory>
+void test_shared_batch()
+{
+    weak_ptr<S<Int>> wptr1;
+    {
+        // three objects side by side in one allocation, each one copied from the same Int
+        Int seed{1};
+        auto batch = make_shared_batch<S<Int>>(3, "batch", seed);
+        print(sptr_tag{}, batch[0], batch[1], batch[2]);
+
+        // but each one is owned on its own: the first one goes, the others stay
+        wptr1 = batch[0];
+        batch[0] = shared_ptr<S<Int>>();
+        printf("wptr1 expired: %d\n", wptr1.expired());
+
+        auto survivor = batch[2];
+        batch.clear();
+        print(sptr_tag{}, survivor);
+    } // survivor goes, but the memory of the batch lives on for wptr1
+
+    printf("wptr1 expired: %d\n", wptr1.expired());
+}
 
-void test_performance()
+void test_aliasing()
 {
-    for (int i = 0; i < 1000000; ++i)
+    shared_ptr<const Int> member;
     {
-        int* tmp(new int(i));
-        delete tmp;
-    }
+        auto sptr1 = make_shared<S<Int>>("sptr1", Int{1});
+        member = shared_ptr<const Int>(sptr1, &sptr1.get()->get()); // points into sptr1, counted with it
+        print(sptr_tag{}, sptr1);
+    } // sptr1 is gone, but member keeps the whole S alive
 
-    auto start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+    printf("member: %c, use_count: %u\n", static_cast<char>(*member.get()), member.use_count());
+}
+
+struct SelfS;
+
+template <>
+inline constexpr bool traces_lifecycle<SelfS> = true; // before enable_shared_from_this<SelfS> names a shared_ptr<SelfS>
+
+struct SelfS : S<Int>, enable_shared_from_this<SelfS> {
+    using S<Int>::S;
+};
+
+void test_shared_from_this()
+{
+    auto sptr1 = make_shared<SelfS>("self1", Int{1});
+    auto sptr2 = sptr1.get()->shared_from_this(); // the same control block, not a second one
+    print(sptr_tag{}, sptr1, sptr2);
+
+    shared_ptr<SelfS> sptr3{new SelfS("self3", Int{3})};
+    auto sptr4 = sptr3.get()->shared_from_this();
+    print(sptr_tag{}, sptr3, sptr4);
+
+    SelfS unowned("self5", Int{5});
+    default_trace::dump();
+    try
     {
-        int* tmp(new int(i));
-        delete tmp;
+        unowned.shared_from_this();
     }
-    auto end = std::chrono::high_resolution_clock::now();
-    printf("new: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
+    catch (const std::bad_weak_ptr& e)
+    {
+        printf("unowned.shared_from_this(): %s\n", e.what());
+    }
+}
+
+void test_atomic_shared_ptr()
+{
+    atomic_shared_ptr<S<Int>> snapshot(make_shared<S<Int>, atomic_count>("snap1", Int{1}));
+
+    auto sptr1 = snapshot.load();
+    print(sptr_tag{}, sptr1);
+
+    snapshot.store(make_shared<S<Int>, atomic_count>("snap2", Int{2})); // sptr1 keeps the old snapshot alive
+    auto sptr2 = snapshot.load();
+    print(sptr_tag{}, sptr1, sptr2);
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+    // sptr1 is not the current snapshot any more, so it is loaded into sptr1 instead
+    printf("compare_exchange_strong(sptr1): %d\n", snapshot.compare_exchange_strong(sptr1, make_shared<S<Int>, atomic_count>("snap3", Int{3})));
+    print(sptr_tag{}, sptr1, sptr2);
+
+    printf("compare_exchange_strong(sptr2): %d\n", snapshot.compare_exchange_strong(sptr2, make_shared<S<Int>, atomic_count>("snap3", Int{3})));
+    auto sptr3 = snapshot.exchange(shared_ptr<S<Int>, atomic_count>());
+    print(sptr_tag{}, sptr1, sptr2, sptr3);
+}
+
+void test_biased_count()
+{
+    auto sptr1 = make_shared<S<Int>, biased_count>("bias1", Int{1});
+    auto sptr2(sptr1); // both references are counted in the main thread's own counter
+    print(sptr_tag{}, sptr1, sptr2);
+
+    // sptr2 is dropped on another thread, which takes the shared counter to -1 and queues the count to us
+    std::thread([&sptr2] { shared_ptr<S<Int>, biased_count> tmp; tmp.swap(sptr2); }).join();
+    print(sptr_tag{}, sptr1, sptr2);
+
+    biased_count::merge_queued();
+    print(sptr_tag{}, sptr1);
+
+    // the other way around: the owner lets go first and merges, so the object is destroyed on the other thread
+    auto sptr3 = make_shared<S<Int>, biased_count>("bias3", Int{3});
+    std::atomic<int> step{0};
+    std::thread other([&] {
+        shared_ptr<S<Int>, biased_count> sptr4(sptr3); // counted in the shared counter
+        step.store(1);
+        while (step.load() != 2)
+            std::this_thread::yield();
+    });
+    while (step.load() != 1)
+        std::this_thread::yield();
     {
-        unique_ptr<int> tmp(new int(i));
+        shared_ptr<S<Int>, biased_count> tmp;
+        tmp.swap(sptr3);
+        print(sptr_tag{}, tmp);
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("unique_ptr: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
+    step.store(2);
+    other.join();
+}
+
+void test_deferred_delete()
+{
+    deferred_reclaimer reclaimer(1024, 256, std::chrono::hours(1)); // no batch will be due on its own here
+    {
+        unique_ptr<S<Int>, deferred_delete<S<Int>>> uptr1{new S("defr1", Int{1}), deferred_delete<S<Int>>(reclaimer)};
+        shared_ptr<S<Int>> sptr2{new S("defr2", Int{2}), deferred_delete<S<Int>>(reclaimer)};
+        print(sptr_tag{}, sptr2);
+    } // nothing is destroyed here...
+    printf("queued: %zu\n", reclaimer.queued());
+
+    reclaimer.drain(); // ...but here
+    default_trace::dump();
+    printf("queued: %zu\n", reclaimer.queued());
+}
+
+void test_hazard_pointer()
+{
+    hazard_pointer_domain domain;
+    std::atomic<S<Int>*> current{make_unique<S<Int>>("hazd1", Int{1}).release()};
+
+    auto hp = domain.make_hazard_pointer();
+    S<Int>* protected_ptr = hp.protect(current);
+    print(uptr_tag{}, protected_ptr);
+
+    // a writer replaces the object and retires the old one, which stays alive as long as it is protected
+    domain.retire(unique_ptr<S<Int>>(current.exchange(make_unique<S<Int>>("hazd2", Int{2}).release())));
+    domain.reclaim();
+    printf("retired: %u\n", domain.retired_count());
+    print(uptr_tag{}, protected_ptr, current.load());
+
+    hp.reset();
+    domain.reclaim();
+    printf("retired: %u\n", domain.retired_count());
+
+    domain.retire(unique_ptr<S<Int>>(current.exchange(nullptr))); // deleted by ~hazard_pointer_domain()
+}
+
+void test_intrusive_ptr()
+{
+    intrusive_ptr<CountedS<Int>> iptr1{new CountedS<Int>("iptr1", Int{1})};
+    print(sptr_tag{}, iptr1);
+
+    auto iptr2 = make_intrusive<CountedS<Int>>("iptr2", Int{2});
+    print(sptr_tag{}, iptr1, iptr2);
+
+    iptr1 = iptr2;
+    print(sptr_tag{}, iptr1, iptr2);
+
+    auto iptr3(move(iptr1));
+    print(sptr_tag{}, iptr1, iptr2, iptr3);
+
+    // the count is in the object, so a handle made from a raw pointer joins the existing owners
+    intrusive_ptr<CountedS<Int>> iptr4(iptr3.get());
+    print(sptr_tag{}, iptr1, iptr2, iptr3, iptr4);
+}
+
+void test_compact_shared_ptr()
+{
+    auto cptr1 = make_compact_shared<S<Int>>("cptr1", Int{1});
+    print(sptr_tag{}, cptr1);
+
+    auto cptr2 = make_compact_shared<S<Int>>("cptr2", Int{2});
+    print(sptr_tag{}, cptr1, cptr2);
+
+    cptr1 = cptr2;
+    print(sptr_tag{}, cptr1, cptr2);
+
+    auto cptr3(move(cptr1));
+    print(sptr_tag{}, cptr1, cptr2, cptr3);
+}
+
+void test_slot_map()
+{
+    slot_map<S<Int>> table;
+    slot_handle h1 = table.emplace("slot1", Int{1});
+    slot_handle h2 = table.emplace("slot2", Int{2});
+    print(uptr_tag{}, table.get(h1), table.get(h2));
+
+    // the slot of h1 is reused, but with a new generation: h1 is stale, it does not see slot3
+    table.erase(h1);
+    slot_handle h3 = table.emplace("slot3", Int{3});
+    printf("h1 {%u, %u}, h3 {%u, %u}\n", h1.index, h1.generation, h3.index, h3.generation);
+    print(uptr_tag{}, table.get(h1), table.get(h2), table.get(h3));
+
+    printf("erase(h1): %d, size: %zu\n", table.erase(h1), table.size());
+
+    const slot_map<S<Int>>& view = table;
+    print(uptr_tag{}, view.get(h2));
+}
+
+#include <chrono>
+#include <memory>
+#include "benchmark.h"
+
+struct CountedInt : intrusive_ref_counter<CountedInt> {
+    explicit CountedInt(int _data) : data(_data) {}
+    int data;
+};
+
+struct AtomicCountedInt : intrusive_ref_counter<AtomicCountedInt, atomic_count> {
+    explicit AtomicCountedInt(int _data) : data(_data) {}
+    int data;
+};
+
+struct small_payload { long long data[2] = {}; };
+struct large_payload { long long data[8] = {}; };
+
+void test_performance()
+{
+    benchmark_suite suite("test_performance");
+
+    suite.run("new", [] { int* tmp(new int(0)); do_not_optimize(tmp); delete tmp; });
+    suite.run("unique_ptr", [] { unique_ptr<int> tmp(new int(0)); do_not_optimize(tmp.get()); });
+    suite.run("make_unique", [] { auto tmp = make_unique<int>(0); do_not_optimize(tmp.get()); });
+    suite.run("make_box", [] { auto tmp = make_box<int>(0); do_not_optimize(tmp.get()); });
+    suite.run("make_box<16 bytes>", [] { auto tmp = make_box<small_payload>(); do_not_optimize(tmp.get()); });
+    suite.run("make_box<64 bytes> (heap)", [] { auto tmp = make_box<large_payload>(); do_not_optimize(tmp.get()); });
+    suite.run("make_unique<64 bytes>", [] { auto tmp = make_unique<large_payload>(); do_not_optimize(tmp.get()); });
+    suite.run("allocate_unique<std::allocator>", [] {
+        auto tmp = allocate_unique<int>(std::allocator<int>(), 0);
+        do_not_optimize(tmp.get());
+    });
+    suite.run("allocate_unique<free_list_allocator>", [] {
+        auto tmp = allocate_unique<int>(free_list_allocator<int>(), 0);
+        do_not_optimize(tmp.get());
+    });
+
+    suite.run("shared_ptr", [] { shared_ptr<int> tmp(new int(0)); do_not_optimize(tmp.get()); });
+    suite.run("make_shared", [] { auto tmp = make_shared<int>(0); do_not_optimize(tmp.get()); });
+    suite.run("make_shared<atomic_count>", [] { auto tmp = make_shared<int, atomic_count>(0); do_not_optimize(tmp.get()); });
+    suite.run("make_shared<biased_count>", [] { auto tmp = make_shared<int, biased_count>(0); do_not_optimize(tmp.get()); });
+    suite.run("allocate_shared<free_list_allocator>", [] {
+        auto tmp = allocate_shared<int>(free_list_allocator<int>(), 0);
+        do_not_optimize(tmp.get());
+    });
+    suite.run("make_intrusive", [] { auto tmp = make_intrusive<CountedInt>(0); do_not_optimize(tmp.get()); });
+    suite.run("make_intrusive<atomic_count>", [] { auto tmp = make_intrusive<AtomicCountedInt>(0); do_not_optimize(tmp.get()); });
+
+    suite.run("std::unique_ptr", [] { std::unique_ptr<int> tmp(new int(0)); do_not_optimize(tmp.get()); });
+    suite.run("std::make_unique", [] { auto tmp = std::make_unique<int>(0); do_not_optimize(tmp.get()); });
+    suite.run("std::shared_ptr", [] { std::shared_ptr<int> tmp(new int(0)); do_not_optimize(tmp.get()); });
+    suite.run("std::make_shared", [] { auto tmp = std::make_shared<int>(0); do_not_optimize(tmp.get()); });
+    suite.run("std::allocate_shared<free_list_allocator>", [] {
+        auto tmp = std::allocate_shared<int>(free_list_allocator<int>(), 0);
+        do_not_optimize(tmp.get());
+    });
+
+    auto owner = make_shared<int>(0);
+    weak_ptr<int> weak(owner);
+    suite.run("weak_ptr::lock", [&] { auto tmp = weak.lock(); do_not_optimize(tmp.get()); });
+
+    auto atomic_owner = make_shared<int, atomic_count>(0);
+    weak_ptr<int, atomic_count> atomic_weak(atomic_owner);
+    suite.run("weak_ptr<atomic_count>::lock", [&] { auto tmp = atomic_weak.lock(); do_not_optimize(tmp.get()); });
+
+    auto std_owner = std::make_shared<int>(0);
+    std::weak_ptr<int> std_weak(std_owner);
+    suite.run("std::weak_ptr::lock", [&] { auto tmp = std_weak.lock(); do_not_optimize(tmp.get()); });
+
+    allocation_counter::print_sites(); // with BENCHMARK_COUNT_ALLOCATIONS only
+}
+
+#include <cstring> // memset
+
+// A scratch buffer that is filled right after it is allocated: make_unique<char[]> zeroes it first, for nothing.
+// A buffer that large is mmap()ed by glibc, and every round would pay for the page faults of fresh zero pages,
+// unless the threshold is raised first: freeing a larger mmap()ed buffer does that. The second warm-up buffer comes
+// from the heap then, and faults its pages in. From then on the buffer is recycled, and what is left to measure
+// is the memory bandwidth.
+void test_performance_overwrite()
+{
+    const size_t size = 16 << 20;
+    benchmark_suite suite("test_performance_overwrite (16 MiB buffer)", 9, 50.0);
+
+    // the barrier in front keeps the compiler from dropping the zeroing as a dead store
+    auto fill = [size](char* buffer) { do_not_optimize(buffer); memset(buffer, 0xa5, size); do_not_optimize(buffer); };
+    for (int warm_up = 0; warm_up < 2; ++warm_up)
+        make_unique<char[]>(size + size / 2);
+
+    const double zeroed = suite.run("make_unique<char[]> + fill", [&] { auto tmp = make_unique<char[]>(size); fill(tmp.get()); }).ns_per_op;
+    const double raw = suite.run("make_unique_for_overwrite<char[]> + fill", [&] { auto tmp = make_unique_for_overwrite<char[]>(size); fill(tmp.get()); }).ns_per_op;
+    suite.run("make_shared_for_overwrite<char[]> + fill", [&] { auto tmp = make_shared_for_overwrite<char[]>(size); fill(tmp.get()); });
+    suite.run("std::make_unique<char[]> + fill", [&] { auto tmp = std::make_unique<char[]>(size); fill(tmp.get()); });
+    suite.run("std::make_unique_for_overwrite<char[]> + fill", [&] { auto tmp = std::make_unique_for_overwrite<char[]>(size); fill(tmp.get()); });
+
+    // the allocation alone: all of the difference is the zeroing
+    suite.run("make_unique<char[]>", [&] { auto tmp = make_unique<char[]>(size); do_not_optimize(tmp.get()); });
+    suite.run("make_unique_for_overwrite<char[]>", [&] { auto tmp = make_unique_for_overwrite<char[]>(size); do_not_optimize(tmp.get()); });
+
+    printf("zeroing: %.1f us per buffer saved (written at %.1f GB/s)\n", (zeroed - raw) / 1000, size / (zeroed - raw));
+}
+
+// Startup: 1000 objects created (and, to keep the rounds alike, destroyed again), one by one or as a batch.
+// The batch is one allocation instead of 1000, and its blocks sit next to each other.
+void test_performance_batch()
+{
+    const size_t count = 1000;
+    benchmark_suite suite("test_performance_batch (1000 objects, ns per 1000)");
+
+    auto one_by_one = [&] {
+        std::vector<shared_ptr<int>> handles(count);
+        for (auto& handle : handles)
+            handle = make_shared<int>(0);
+        do_not_optimize(handles.data());
+    };
+    auto batch = [&] { auto handles = make_shared_batch<int>(count, 0); do_not_optimize(handles.data()); };
+    auto std_one_by_one = [&] {
+        std::vector<std::shared_ptr<int>> handles(count);
+        for (auto& handle : handles)
+            handle = std::make_shared<int>(0);
+        do_not_optimize(handles.data());
+    };
+
+    suite.run("make_shared x 1000", one_by_one);
+    suite.run("make_shared_batch(1000)", batch);
+    suite.run("std::make_shared x 1000", std_one_by_one);
+
+    report_allocations("make_shared x 1000", one_by_one);
+    report_allocations("make_shared_batch(1000)", batch);
+}
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+// Iterating over 10M handles, built one type at a time so that only one set of them is alive at once.
+// scan only reads the handles (does the slot hold an object?), sum reads the objects behind them as well.
+// The objects are allocated in order, so both walks are sequential and the handle size decides how much memory
+// has to stream through the caches: 160 MB of shared_ptrs against 80 MB of compact_shared_ptrs.
+template <typename Handle, typename Make, typename Value>
+void iterate_handles(benchmark_suite& suite, const char* name, Make make, Value value)
+{
+    const int count = 10000000;
+
+    std::vector<Handle> handles;
+    handles.reserve(count);
+    for (int i = 0; i < count; ++i)
+        handles.push_back(make(i));
+
+    char row[64];
+    snprintf(row, sizeof(row), "%s scan", name);
+    suite.run(row, [&] {
+        size_t engaged = 0;
+        for (const Handle& handle : handles)
+            engaged += handle.get() != nullptr;
+        do_not_optimize(engaged);
+    });
+
+    snprintf(row, sizeof(row), "%s sum", name);
+    suite.run(row, [&] {
+        long long sum = 0;
+        for (const Handle& handle : handles)
+            sum += value(handle);
+        do_not_optimize(sum);
+    });
+}
+
+void test_performance_compact()
+{
+    benchmark_suite suite("test_performance_compact (10M handles, ns per pass)", 5);
+
+    iterate_handles<shared_ptr<int>>(suite, "shared_ptr", [](int i) { return make_shared<int>(i); },
+                                     [](const shared_ptr<int>& h) { return *h.get(); });
+    iterate_handles<compact_shared_ptr<int>>(suite, "compact_shared_ptr", [](int i) { return make_compact_shared<int>(i); },
+                                             [](const compact_shared_ptr<int>& h) { return *h.get(); });
+    iterate_handles<intrusive_ptr<CountedInt>>(suite, "intrusive_ptr", [](int i) { return make_intrusive<CountedInt>(i); },
+                                               [](const intrusive_ptr<CountedInt>& h) { return h.get()->data; });
+    iterate_handles<std::shared_ptr<int>>(suite, "std::shared_ptr", [](int i) { return std::make_shared<int>(i); },
+                                          [](const std::shared_ptr<int>& h) { return *h; });
+}
+
+#include <random>
+
+// Looking objects up by reference in a table of 1M of them, in a random order:
+// - a shared_ptr copy keeps the object alive while it is used, at the price of two count updates
+// - weak_ptr::lock and slot_map::get also tell whether the object is still there; lock() updates the count, get() does not
+// Over the whole table every kind of lookup waits for the same cache misses; over a hot set of 4096 objects
+// that stays in the caches, what is left is the work of the lookup itself.
+void test_performance_slot_map()
+{
+    const size_t count = 1 << 20;
+    benchmark_suite suite("test_performance_slot_map (random lookups)");
+
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+    std::vector<shared_ptr<int>> owners;
+    std::vector<weak_ptr<int>> weaks;
+    std::vector<shared_ptr<int, atomic_count>> atomic_owners;
+    std::vector<weak_ptr<int, atomic_count>> atomic_weaks;
+    std::vector<std::shared_ptr<int>> std_owners;
+    std::vector<std::weak_ptr<int>> std_weaks;
+    slot_map<int> table;
+    std::vector<slot_handle> handles;
+    for (size_t i = 0; i < count; ++i)
     {
-        auto tmp = make_unique<int>(i);
+        owners.push_back(make_shared<int>(static_cast<int>(i)));
+        weaks.emplace_back(owners.back());
+        atomic_owners.push_back(make_shared<int, atomic_count>(static_cast<int>(i)));
+        atomic_weaks.emplace_back(atomic_owners.back());
+        std_owners.push_back(std::make_shared<int>(static_cast<int>(i)));
+        std_weaks.emplace_back(std_owners.back());
+        handles.push_back(table.emplace(static_cast<int>(i)));
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("make_unique: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+    for (size_t objects : {size_t(4096), count})
     {
-        shared_ptr<int> tmp(new int(i));
+        size_t next = 0;
+        const size_t mask = objects - 1;
+        auto lookup = [&] { next = (next + 1) & mask; return order[next] & mask; };
+
+        char row[64];
+        auto name = [&](const char* what) { snprintf(row, sizeof(row), "%s (%zu)", what, objects); return row; };
+
+        suite.run(name("shared_ptr copy"), [&] { shared_ptr<int> tmp(owners[lookup()]); do_not_optimize(*tmp.get()); });
+        suite.run(name("weak_ptr::lock"), [&] { auto tmp = weaks[lookup()].lock(); do_not_optimize(*tmp.get()); });
+        suite.run(name("weak_ptr<atomic_count>::lock"), [&] { auto tmp = atomic_weaks[lookup()].lock(); do_not_optimize(*tmp.get()); });
+        suite.run(name("std::weak_ptr::lock"), [&] { auto tmp = std_weaks[lookup()].lock(); do_not_optimize(*tmp); });
+        suite.run(name("slot_map::get"), [&] { do_not_optimize(*table.get(handles[lookup()])); });
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("shared_ptr: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
+}
+
+// Contention: every thread works on handles to the same `objects`, thread t starting at object t.
+// With a single object, every count update bounces one cache line between the cores;
+// with many, the threads mostly touch different lines, and we only pay for the instructions themselves.
+enum class workload { copy, destroy, move, use_count };
+
+// Runs `iterations` operations of workload w on each of n_threads threads at once.
+// Returns the time from the start signal to the last thread finishing, in ns.
+template <typename SharedPtr>
+double contention(workload w, unsigned n_threads, const std::vector<SharedPtr>& objects, int iterations)
+{
+    const size_t mask = objects.size() - 1; // a power of two, a division would cost more than some of the operations
+
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::chrono::steady_clock::time_point> finished(n_threads);
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < n_threads; ++t)
+        threads.emplace_back([&, t] {
+            // destroy: the copies are made before the clock starts
+            std::vector<SharedPtr> copies;
+            if (w == workload::destroy)
+            {
+                copies.reserve(iterations);
+                for (int i = 0; i < iterations; ++i)
+                    copies.emplace_back(objects[(t + i) & mask]);
+            }
+            SharedPtr handle(objects[t & mask]);
+
+            ready.fetch_add(1);
+            while (not go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            switch (w)
+            {
+            case workload::copy:
+                for (int i = 0; i < iterations; ++i)
+                {
+                    SharedPtr tmp(objects[(t + i) & mask]);
+                    do_not_optimize(tmp.get());
+                }
+                break;
+            case workload::destroy:
+                copies.clear();
+                break;
+            case workload::move:
+                // in and back out again
+                for (int i = 0; i < iterations; ++i)
+                {
+                    SharedPtr tmp(::move(handle));
+                    do_not_optimize(tmp.get());
+                    handle = ::move(tmp);
+                }
+                break;
+            case workload::use_count:
+                for (int i = 0; i < iterations; ++i)
+                    do_not_optimize(objects[(t + i) & mask].use_count());
+                break;
+            }
+            finished[t] = std::chrono::steady_clock::now();
+        });
+
+    while (ready.load() != n_threads)
+        std::this_thread::yield();
+
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads)
+        thread.join();
+
+    return std::chrono::duration<double, std::nano>(*std::max_element(finished.begin(), finished.end()) - start).count();
+}
+
+// n handles to new objects, made on this thread (which makes it the owner of the biased_count ones)
+template <typename SharedPtr, typename Object = int>
+std::vector<SharedPtr> make_objects(size_t n)
+{
+    std::vector<SharedPtr> objects(n);
+    for (auto& object : objects)
+        object = SharedPtr(new Object(0));
+    return objects;
+}
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+void test_performance_mt()
+{
+    const int iterations = 1000000;
+    const size_t object_counts[] = {1, 16, 1024};
+    const char* const workload_names[] = {"copy", "destroy", "move", "use_count"};
+
+    // shared_ptr<int, nonatomic_count> cannot be shared between threads, so it is not in here
+    std::vector<shared_ptr<int, atomic_count>> atomic[3];
+    std::vector<shared_ptr<int, biased_count>> biased[3];
+    std::vector<intrusive_ptr<AtomicCountedInt>> intrusive[3];
+    std::vector<std::shared_ptr<int>> std_shared[3];
+    for (int c = 0; c < 3; ++c)
     {
-        auto tmp = make_shared<int>(i);
+        atomic[c]       = make_objects<shared_ptr<int, atomic_count>>(object_counts[c]);
+        biased[c]       = make_objects<shared_ptr<int, biased_count>>(object_counts[c]);
+        intrusive[c]    = make_objects<intrusive_ptr<AtomicCountedInt>, AtomicCountedInt>(object_counts[c]);
+        std_shared[c]   = make_objects<std::shared_ptr<int>>(object_counts[c]);
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("make_shared: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+    const unsigned max_threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+    for (unsigned n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads)
     {
-        std::unique_ptr<int> tmp(new int(i));
+        printf("%u thread(s), %d operations per thread (throughput of all threads, latency of one operation)\n", n, iterations);
+        for (auto w : {workload::copy, workload::destroy, workload::move, workload::use_count})
+            for (int c = 0; c < 3; ++c)
+            {
+                auto row = [&](const char* name, const auto& objects) {
+                    double ns[5];
+                    for (auto& run : ns)
+                        run = contention(w, n, objects, iterations);
+                    std::sort(ns, ns + 5);
+                    printf("  %-9s %4zu object(s)  %-31s %9.2f Mops/s %8.2f ns/op\n", workload_names[int(w)],
+                           object_counts[c], name, 1e3 * n * iterations / ns[2], ns[2] / iterations);
+                };
+                row("shared_ptr<atomic_count>", atomic[c]);
+                row("shared_ptr<biased_count>", biased[c]);
+                row("intrusive_ptr<atomic_count>", intrusive[c]);
+                row("std::shared_ptr", std_shared[c]);
+            }
+
+        if (n == max_threads)
+            break;
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("std::unique_ptr: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+    // every copy made on the other threads is gone again
+    printf("use_count after the runs: %u (atomic_count), %u (biased_count), %u (intrusive_ptr), %ld (std::shared_ptr)\n",
+           atomic[0][0].use_count(), biased[0][0].use_count(), intrusive[0][0].use_count(), std_shared[0][0].use_count());
+}
+
+struct Config {
+    explicit Config(int _version) : version(_version) {}
+    int version;
+};
+
+// n_readers threads load the current snapshot `reads` times each, while one more thread keeps publishing new ones.
+template <typename Publish, typename Read>
+float read_while_publishing(unsigned n_readers, int reads, Publish publish, Read read)
+{
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> done{false};
+    std::atomic<long long> checksum{0}; // so that the reads cannot be optimized away
+
+    std::thread writer([&] {
+        for (int version = 1; not done.load(std::memory_order_relaxed); ++version)
+        {
+            publish(version);
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < n_readers; ++t)
+        readers.emplace_back([&] {
+            ready.fetch_add(1);
+            while (not go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            long long sum = 0;
+            for (int i = 0; i < reads; ++i)
+                sum += read();
+            checksum.fetch_add(sum);
+        });
+
+    while (ready.load() != n_readers)
+        std::this_thread::yield();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& reader : readers)
+        reader.join();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    done.store(true);
+    writer.join();
+
+    return std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+void test_performance_snapshot()
+{
+    using handle = shared_ptr<Config, atomic_count>;
+    const int reads = 1000000;
+
+    atomic_shared_ptr<Config> lock_free(make_shared<Config, atomic_count>(0));
+    auto lock_free_publish = [&](int version) { lock_free.store(make_shared<Config, atomic_count>(version)); };
+    auto lock_free_read = [&] { return lock_free.load().get()->version; };
+
+    std::mutex mutex;
+    handle locked = make_shared<Config, atomic_count>(0);
+    auto locked_publish = [&](int version) {
+        handle fresh = make_shared<Config, atomic_count>(version);
+        std::lock_guard<std::mutex> lock(mutex);
+        locked.swap(fresh); // the old snapshot is released after the lock
+    };
+    auto locked_read = [&] {
+        handle current = [&] { std::lock_guard<std::mutex> lock(mutex); return handle(locked); }();
+        return current.get()->version;
+    };
+
+#ifdef __cpp_lib_atomic_shared_ptr
+    std::atomic<std::shared_ptr<Config>> std_atomic(std::make_shared<Config>(0));
+    auto std_atomic_publish = [&](int version) { std_atomic.store(std::make_shared<Config>(version)); };
+    auto std_atomic_read = [&] { return std_atomic.load()->version; };
+#endif
+
+    const unsigned max_threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+    for (unsigned n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads)
     {
-        auto tmp = std::make_unique<int>(i);
+        printf("%u reader(s) + 1 writer, %d loads per reader\n", n, reads);
+
+        float ms = read_while_publishing(n, reads, lock_free_publish, lock_free_read);
+        printf("  atomic_shared_ptr::load:              %f ms (%f ns/load)\n", ms, ms * 1e6f / reads);
+
+        ms = read_while_publishing(n, reads, locked_publish, locked_read);
+        printf("  std::mutex + shared_ptr:              %f ms (%f ns/load)\n", ms, ms * 1e6f / reads);
+
+#ifdef __cpp_lib_atomic_shared_ptr
+        ms = read_while_publishing(n, reads, std_atomic_publish, std_atomic_read);
+        printf("  std::atomic<std::shared_ptr>::load:   %f ms (%f ns/load)\n", ms, ms * 1e6f / reads);
+#endif
+
+        if (n == max_threads)
+            break;
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("std::make_unique: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
+}
+
+// as many heap nodes to free as there were to allocate
+struct Graph {
+    explicit Graph(int n) : nodes(n) { for (auto& node : nodes) node = std::make_unique<int>(0); }
+    std::vector<std::unique_ptr<int>> nodes;
+};
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+// How long the caller is held up by letting go of each of `graphs`, one at a time: percentiles, in us
+template <typename Handle, typename... Deleter>
+void drop_latency(const char* name, std::vector<Graph*>& graphs, Deleter... deleter)
+{
+    std::vector<float> us;
+    us.reserve(graphs.size());
+    for (Graph*& graph : graphs)
     {
-        std::shared_ptr<int> tmp(new int(i));
+        auto start = std::chrono::high_resolution_clock::now();
+        {
+            Handle tmp(graph, deleter...);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        us.push_back(std::chrono::duration<float, std::micro>(end - start).count());
+        graph = nullptr;
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("std::shared_ptr: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
+    std::sort(us.begin(), us.end());
+    printf("%s: p50 %f us, p99 %f us, max %f us\n", name, us[us.size() / 2], us[us.size() * 99 / 100], us.back());
+}
+
+void test_performance_deferred()
+{
+    const int n_graphs = 1000, n_nodes = 1000;
+    auto make_graphs = [&] {
+        std::vector<Graph*> graphs(n_graphs);
+        for (auto& graph : graphs)
+            graph = new Graph(n_nodes);
+        return graphs;
+    };
+    deferred_reclaimer reclaimer;
+
+    auto graphs = make_graphs();
+    drop_latency<unique_ptr<Graph>>("unique_ptr<Graph>", graphs);
+
+    graphs = make_graphs();
+    drop_latency<unique_ptr<Graph, deferred_delete<Graph>>>("unique_ptr<Graph, deferred_delete>", graphs, deferred_delete<Graph>(reclaimer));
+
+    graphs = make_graphs();
+    drop_latency<shared_ptr<Graph>>("shared_ptr<Graph>(deferred_delete)", graphs, deferred_delete<Graph>(reclaimer));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    reclaimer.drain();
+    auto end = std::chrono::high_resolution_clock::now();
+    printf("drain: %f ms, destroyed inline: %zu\n", std::chrono::duration<float, std::milli>(end - start).count(), reclaimer.destroyed_inline());
+}
+
+void test_performance_hazard_pointer()
+{
+    const int reads = 1000000;
+
+    // no reclamation at all: the old objects are only freed after the run, which is the best a reader can hope for
+    std::atomic<Config*> unprotected{new Config(0)};
+    std::vector<Config*> graveyard;
+    auto unprotected_publish = [&](int version) { graveyard.push_back(unprotected.exchange(new Config(version))); };
+    auto unprotected_read = [&] { return unprotected.load(std::memory_order_acquire)->version; };
+
+    hazard_pointer_domain domain;
+    std::atomic<Config*> protected_current{make_unique<Config>(0).release()};
+    auto protected_publish = [&](int version) {
+        domain.retire(unique_ptr<Config>(protected_current.exchange(make_unique<Config>(version).release())));
+    };
+    auto protected_read = [&] {
+        thread_local hazard_pointer_domain::hazard_pointer hp = domain.make_hazard_pointer();
+        const int version = hp.protect(protected_current)->version;
+        hp.reset();
+        return version;
+    };
+
+    atomic_shared_ptr<Config> counted(make_shared<Config, atomic_count>(0));
+    auto counted_publish = [&](int version) { counted.store(make_shared<Config, atomic_count>(version)); };
+    auto counted_read = [&] { return counted.load().get()->version; };
 
-    start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < 100000000; ++i)
+    // every reader holds one of the domain's slots: keep one spare rather than make make_hazard_pointer() throw in a thread
+    const unsigned hardware_threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+    const unsigned max_threads = std::min(hardware_threads, hazard_pointer_domain::max_hazard_pointers - 1);
+    for (unsigned n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads)
     {
-        auto tmp = std::make_shared<int>(i);
+        printf("%u reader(s) + 1 writer, %d reads per reader\n", n, reads);
+
+        float ms = read_while_publishing(n, reads, unprotected_publish, unprotected_read);
+        printf("  unprotected:                          %f ms (%f ns/read)\n", ms, ms * 1e6f / reads);
+
+        ms = read_while_publishing(n, reads, protected_publish, protected_read);
+        printf("  hazard pointer:                       %f ms (%f ns/read)\n", ms, ms * 1e6f / reads);
+
+        ms = read_while_publishing(n, reads, counted_publish, counted_read);
+        printf("  atomic_shared_ptr:                    %f ms (%f ns/read)\n", ms, ms * 1e6f / reads);
+
+        if (n == max_threads)
+            break;
     }
-    end = std::chrono::high_resolution_clock::now();
-    printf("std::make_shared: %f ms\n", std::chrono::duration<float, std::milli>(end - start).count());
+
+    for (Config* config : graveyard)
+        delete config;
+    delete unprotected.load();
+    domain.retire(unique_ptr<Config>(protected_current.exchange(nullptr)));
 }
 
 int main()
 {
     test_unique_ptr();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_unique_ptr_deleter();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_for_overwrite();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_box();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_allocate();
+    default_trace::dump();
 
     std::cout << "\n";
 
     test_shared_ptr();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_weak_ptr();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_shared_batch();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_aliasing();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_shared_from_this();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_atomic_shared_ptr();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_biased_count();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_deferred_delete();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_hazard_pointer();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_intrusive_ptr();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_compact_shared_ptr();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_slot_map();
+    default_trace::dump();
 
     std::cout << "\n";
 
     test_performance();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_overwrite();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_batch();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_compact();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_slot_map();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_mt();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_snapshot();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_hazard_pointer();
+    default_trace::dump();
+
+    std::cout << "\n";
+
+    test_performance_deferred();
+    default_trace::dump();
 }
@@ -0,0 +1,403 @@
+// A small micro-benchmark harness for the snippets in this repository.
+//
+//     benchmark_suite suite("test_performance");
+//     suite.run("make_shared", [] { auto tmp = make_shared<int>(0); do_not_optimize(tmp.get()); });
+//
+// run() grows the iteration count until a batch takes at least `min_batch_ms` (those batches double as the warm-up),
+// then times `runs` batches and reports the median time per operation and the median absolute deviation (MAD) of the
+// batches. Unlike the mean and the standard deviation, both shrug off the odd batch that got preempted.
+//
+// Results are printed as they come: as text by default, or as CSV or JSON with BENCHMARK_FORMAT=csv|json ./a.out
+//
+// The operation is a lambda that the loop calls through a template, so it is inlined into the loop:
+// anything it computes that is not passed to do_not_optimize() may be optimized away, allocations included.
+//
+// Built with -DBENCHMARK_COUNT_ALLOCATIONS, the program's global operator new and delete are replaced by counting ones
+// (see allocation_counter below), and every row reports allocations/op and bytes/op as well.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Barriers for the optimizer (GCC and Clang syntax).
+// do_not_optimize(value): value has to be computed and may be read by someone, so the code producing it stays
+// clobber_memory(): every store before it happens, and every load after it reads memory again
+template <typename T>
+inline void do_not_optimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobber_memory()
+{
+    asm volatile("" : : : "memory");
+}
+
+struct allocation_counts {
+    long long allocations = 0;
+    long long frees = 0;
+    long long bytes = 0;        // allocated
+    long long freed_bytes = 0;
+
+    long long live() const          { return allocations - frees; }
+    long long live_bytes() const    { return bytes - freed_bytes; }
+
+    friend allocation_counts operator-(const allocation_counts& _lhs, const allocation_counts& _rhs)
+    {
+        return {_lhs.allocations - _rhs.allocations, _lhs.frees - _rhs.frees,
+                _lhs.bytes - _rhs.bytes, _lhs.freed_bytes - _rhs.freed_bytes};
+    }
+};
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <execinfo.h> // backtrace(), glibc
+#include <new>
+
+// Counts every allocation made through the global operator new (replaced below) since the program started.
+// Each block carries a header with its size, so that unsized deletes know how much they give back.
+// One in every sample_period allocations also records its call stack: print_sites() lists the call sites that
+// allocated the most, estimated from the samples. Build with -g -rdynamic to see function names rather than addresses.
+class allocation_counter
+{
+    struct header {
+        std::size_t size;
+        std::size_t offset;     // from the start of the malloc'ed block to the object
+    };
+
+    static constexpr int max_depth  = 16;
+    static constexpr int max_sites  = 256;
+
+    struct site {
+        void* frames[max_depth];
+        int depth;
+        long long samples;
+        long long bytes;
+    };
+
+public:
+    static constexpr bool enabled           = true;
+    static constexpr int sample_period      = 1024;
+
+    static allocation_counts now()
+    {
+        return {s_allocations.load(std::memory_order_relaxed), s_frees.load(std::memory_order_relaxed),
+                s_bytes.load(std::memory_order_relaxed), s_freed_bytes.load(std::memory_order_relaxed)};
+    }
+
+    static void print_sites(int _max_sites = 5)
+    {
+        lock();
+        site* sites[max_sites];
+        int n_sites = 0;
+        for (auto& site : s_sites)
+            if (site.samples)
+                sites[n_sites++] = &site;
+        std::sort(sites, sites + n_sites, [](const site* a, const site* b) { return a->bytes > b->bytes; });
+
+        printf("top allocation sites (1 in %d allocations sampled)\n", sample_period);
+        for (int i = 0; i < n_sites && i < _max_sites; ++i)
+        {
+            printf("  ~%lld allocations, ~%lld bytes\n", sites[i]->samples * sample_period, sites[i]->bytes * sample_period);
+            fflush(stdout);
+            backtrace_symbols_fd(sites[i]->frames, sites[i]->depth, fileno(stdout)); // does not allocate
+        }
+        unlock();
+    }
+
+    // nullptr if out of memory. Not inlined, so that sample() knows how many frames to skip
+    [[gnu::noinline]] static void* allocate(std::size_t _size, std::size_t _align)
+    {
+        const std::size_t offset = _align > sizeof(header) ? _align : sizeof(header);
+        char* block = static_cast<char*>(_align > alignof(std::max_align_t)
+                                             ? std::aligned_alloc(_align, (offset + _size + _align - 1) / _align * _align)
+                                             : std::malloc(offset + _size));
+        if (not block)
+            return nullptr;
+
+        char* ptr = block + offset;
+        *reinterpret_cast<header*>(ptr - sizeof(header)) = {_size, offset};
+
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        s_bytes.fetch_add(_size, std::memory_order_relaxed);
+        if (--s_until_sample == 0)
+        {
+            s_until_sample = sample_period;
+            sample(_size);
+        }
+        return ptr;
+    }
+
+    static void deallocate(void* _ptr)
+    {
+        if (not _ptr)
+            return;
+
+        char* ptr = static_cast<char*>(_ptr);
+        const header h = *reinterpret_cast<header*>(ptr - sizeof(header));
+        s_frees.fetch_add(1, std::memory_order_relaxed);
+        s_freed_bytes.fetch_add(h.size, std::memory_order_relaxed);
+        std::free(ptr - h.offset);
+    }
+
+private:
+    [[gnu::noinline]] static void sample(std::size_t _size)
+    {
+        if (s_sampling) // backtrace() may allocate the first time around
+            return;
+        s_sampling = true;
+
+        void* frames[max_depth + 3];
+        const int depth = backtrace(frames, max_depth + 3) - 3; // without sample(), allocate() and operator new
+        if (depth > 0)
+        {
+            std::uintptr_t hash = 0;
+            for (int i = 0; i < depth; ++i)
+                hash = hash * 31 + reinterpret_cast<std::uintptr_t>(frames[i + 3]);
+
+            lock();
+            for (int i = 0; i < max_sites; ++i) // open addressing: a full table simply drops the sample
+            {
+                site& site = s_sites[(hash + i) % max_sites];
+                if (site.samples && (site.depth != depth || not std::equal(frames + 3, frames + 3 + depth, site.frames)))
+                    continue;
+                if (not site.samples)
+                {
+                    std::copy(frames + 3, frames + 3 + depth, site.frames);
+                    site.depth = depth;
+                }
+                ++site.samples;
+                site.bytes += _size;
+                break;
+            }
+            unlock();
+        }
+        s_sampling = false;
+    }
+
+    static void lock()      { while (s_sites_lock.test_and_set(std::memory_order_acquire)) ; }
+    static void unlock()    { s_sites_lock.clear(std::memory_order_release); }
+
+    inline static std::atomic<long long> s_allocations{0};
+    inline static std::atomic<long long> s_frees{0};
+    inline static std::atomic<long long> s_bytes{0};
+    inline static std::atomic<long long> s_freed_bytes{0};
+
+    inline static thread_local int s_until_sample = sample_period;
+    inline static thread_local bool s_sampling = false;
+    inline static std::atomic_flag s_sites_lock = ATOMIC_FLAG_INIT;
+    inline static site s_sites[max_sites];
+};
+
+// The replaceable forms: the nothrow ones and the array and sized deletes of the standard library forward to these.
+// None of them is inlined: in the caller, GCC would see the header arithmetic of allocate() and deallocate() and warn
+// about a read before the start of the object (-Warray-bounds) and a free() of what new returned (-Wmismatched-new-delete).
+[[gnu::noinline]] void* operator new(std::size_t _size)
+{
+    if (void* ptr = allocation_counter::allocate(_size, __STDCPP_DEFAULT_NEW_ALIGNMENT__))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t _size)
+{
+    return ::operator new(_size);
+}
+
+[[gnu::noinline]] void* operator new(std::size_t _size, std::align_val_t _align)
+{
+    if (void* ptr = allocation_counter::allocate(_size, static_cast<std::size_t>(_align)))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t _size, std::align_val_t _align)
+{
+    return ::operator new(_size, _align);
+}
+
+[[gnu::noinline]] void operator delete(void* _ptr) noexcept                                       { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete[](void* _ptr) noexcept                                     { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete(void* _ptr, std::size_t) noexcept                          { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete[](void* _ptr, std::size_t) noexcept                        { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete(void* _ptr, std::align_val_t) noexcept                     { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete[](void* _ptr, std::align_val_t) noexcept                   { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete(void* _ptr, std::size_t, std::align_val_t) noexcept        { allocation_counter::deallocate(_ptr); }
+[[gnu::noinline]] void operator delete[](void* _ptr, std::size_t, std::align_val_t) noexcept      { allocation_counter::deallocate(_ptr); }
+
+#else
+
+class allocation_counter
+{
+public:
+    static constexpr bool enabled = false;
+
+    static allocation_counts now()  { return {}; }
+    static void print_sites(int = 5) {}
+};
+
+#endif
+
+// What one call of op allocates, for the drivers whose operations print traces and cannot be timed in a loop.
+// op runs either way, so that the traces are the same with and without counting. The net change counts frees of
+// blocks allocated before op as well: moving from an object that owns one gives a negative net.
+template <typename Op>
+void report_allocations(const char* _name, Op _op)
+{
+    const allocation_counts before = allocation_counter::now();
+    _op();
+    const allocation_counts counts = allocation_counter::now() - before;
+
+    if constexpr (not allocation_counter::enabled)
+        printf("%s: build with -DBENCHMARK_COUNT_ALLOCATIONS to count allocations\n", _name);
+    else
+        printf("%s: %lld allocation(s), %lld bytes, %lld free(s), net %+lld block(s)\n", _name,
+               counts.allocations, counts.bytes, counts.frees, counts.live());
+}
+
+struct benchmark_result {
+    std::string name;       // a copy: callers often format the name into a buffer they reuse for the next row
+    double ns_per_op;       // median of the runs
+    double mad_ns;          // median absolute deviation of the runs
+    long long iterations;   // per run
+    int runs;
+    double allocs_per_op;   // with BENCHMARK_COUNT_ALLOCATIONS only
+    double bytes_per_op;
+};
+
+class benchmark_suite
+{
+public:
+    enum class format { text, csv, json };
+
+    explicit benchmark_suite(const char* _name, int _runs = 15, double _min_batch_ms = 10.0)
+        : m_name(_name), m_format(format_from_env()), m_runs(_runs), m_min_batch_ms(_min_batch_ms)
+    {
+        if (m_format == format::csv)
+            printf("suite,name,ns_per_op,mad_ns,iterations,runs%s\n", allocation_counter::enabled ? ",allocs_per_op,bytes_per_op" : "");
+        else if (m_format == format::json)
+            printf("{\"suite\": \"%s\", \"results\": [\n", m_name);
+        else
+            printf("%s (median ns/op +- MAD)\n", m_name);
+    }
+
+    ~benchmark_suite()
+    {
+        if (m_format == format::json)
+            printf("\n]}\n");
+    }
+
+    benchmark_suite(const benchmark_suite&)             = delete;
+    benchmark_suite& operator=(const benchmark_suite&)  = delete;
+
+    template <typename Op>
+    benchmark_result run(const char* _name, Op _op)
+    {
+        // calibrate: the first batches warm up the caches, the allocator and the branch predictors as well
+        long long iterations = 1;
+        for (;;)
+        {
+            const double ms = batch(iterations, _op) / 1e6;
+            if (ms >= m_min_batch_ms || iterations >= max_iterations) // an empty loop takes no time at all
+                break;
+            // aim a bit past the target, but do not trust batches too short to be measured
+            iterations = ms < m_min_batch_ms / 10 ? iterations * 10
+                                                  : static_cast<long long>(iterations * m_min_batch_ms / ms * 1.2) + 1;
+        }
+
+        std::vector<double> ns_per_op(m_runs);
+        const allocation_counts before = allocation_counter::now();
+        for (auto& ns : ns_per_op)
+            ns = batch(iterations, _op) / iterations;
+        const allocation_counts counts = allocation_counter::now() - before;
+
+        const double median = median_of(ns_per_op);
+        for (auto& ns : ns_per_op)
+            ns = ns > median ? ns - median : median - ns;
+
+        const double ops = static_cast<double>(iterations) * m_runs;
+        m_results.push_back({_name, median, median_of(ns_per_op), iterations, m_runs, counts.allocations / ops, counts.bytes / ops});
+        print(m_results.back());
+        return m_results.back();
+    }
+
+    const std::vector<benchmark_result>& results() const    { return m_results; }
+
+private:
+    static format format_from_env()
+    {
+        const char* env = std::getenv("BENCHMARK_FORMAT");
+        if (env && std::strcmp(env, "csv") == 0)
+            return format::csv;
+        if (env && std::strcmp(env, "json") == 0)
+            return format::json;
+        return format::text;
+    }
+
+    // nanoseconds for `iterations` calls of op
+    template <typename Op>
+    static double batch(long long _iterations, Op& _op)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < _iterations; ++i)
+            _op();
+        clobber_memory();
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    static double median_of(std::vector<double>& _values)
+    {
+        const auto mid = _values.begin() + _values.size() / 2;
+        std::nth_element(_values.begin(), mid, _values.end());
+        if (_values.size() % 2)
+            return *mid;
+        return (*mid + *std::max_element(_values.begin(), mid)) / 2;
+    }
+
+    void print(const benchmark_result& _result) const
+    {
+        switch (m_format)
+        {
+        case format::csv:
+            printf("%s,%s,%.3f,%.3f,%lld,%d", m_name, _result.name.c_str(), _result.ns_per_op, _result.mad_ns,
+                   _result.iterations, _result.runs);
+            if (allocation_counter::enabled)
+                printf(",%.3f,%.3f", _result.allocs_per_op, _result.bytes_per_op);
+            printf("\n");
+            break;
+        case format::json:
+            printf("%s  {\"name\": \"%s\", \"ns_per_op\": %.3f, \"mad_ns\": %.3f, \"iterations\": %lld, \"runs\": %d",
+                   m_results.size() > 1 ? ",\n" : "", _result.name.c_str(), _result.ns_per_op, _result.mad_ns,
+                   _result.iterations, _result.runs);
+            if (allocation_counter::enabled)
+                printf(", \"allocs_per_op\": %.3f, \"bytes_per_op\": %.3f", _result.allocs_per_op, _result.bytes_per_op);
+            printf("}");
+            break;
+        case format::text:
+            printf("  %-45s %10.3f ns/op +- %.3f (%d x %lld)", _result.name.c_str(), _result.ns_per_op, _result.mad_ns,
+                   _result.runs, _result.iterations);
+            if (allocation_counter::enabled)
+                printf(" %6.2f allocs/op %8.1f bytes/op", _result.allocs_per_op, _result.bytes_per_op);
+            printf("\n");
+            break;
+        }
+    }
+
+    static constexpr long long max_iterations = 10000000000;
+
+    const char* m_name;
+    format m_format;
+    int m_runs;
+    double m_min_batch_ms;
+    std::vector<benchmark_result> m_results;
+};
@@ -0,0 +1,390 @@
+// Reduction and transform kernels over contiguous arithmetic elements, for Array and Span (201027) and anything
+// else with data() and size().
+//
+//     float total = simd::sum(span);
+//     simd::transform(in, out, [](const auto& x) { return x * 2 + 1; });
+//
+// Every kernel is written once, over GCC vector extensions (T __attribute__((vector_size(Bytes)))), and compiled
+// three times with __attribute__((target(...))): 16-byte vectors for SSE2, 32 for AVX2, 64 for AVX-512 (F and BW,
+// so that the 8- and 16-bit types get the wide registers as well). The compiler picks the instructions, including
+// the sequences that stand in for what an ISA lacks (SSE2 has no pminsb, nothing before AVX-512 multiplies 64-bit
+// lanes). The instruction set is detected with cpuid once, the first time a kernel runs; every call then switches
+// on it, a branch that is always predicted. Other targets only get the scalar loops.
+//
+// - the types are the arithmetic ones but bool, what the type-traits lessons call is_integral and is_floating_point
+// - sum and dot of integers are added up (and multiplied) as unsigned, so a result that does not fit in T wraps
+//   around, the same in every kernel, signed types included; a floating-point sum is added up in a different order
+//   in every kernel, so it may differ from the scalar one in the last bits
+// - min and max need at least one element, and assume there are no NaNs
+// - transform calls f with a T for the scalar tail and with a vector of T for the rest, so f must be generic,
+//   [](const auto& x) { return x * 2 + 1; }; out may be the same as in, but must not overlap it otherwise
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// The kernels pass AVX vectors around in code compiled for the baseline instruction set, and GCC warns
+// that this changes the ABI. It never happens: everything that takes or returns a vector is always inlined
+// into a function compiled for the right instruction set. The f of transform is inlined the same way, but GCC
+// reports its warning at the lambda, in the caller's code, and again at the end of the caller's file: the pragmas
+// below reach neither, so callers that pass a generic lambda have to silence -Wpsabi themselves (see 201027).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace simd {
+
+enum class isa { scalar, sse2, avx2, avx512 };
+
+inline const char* isa_name(isa _isa)
+{
+    switch (_isa)
+    {
+    case isa::sse2:     return "sse2";
+    case isa::avx2:     return "avx2";
+    case isa::avx512:   return "avx512";
+    default:            return "scalar";
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+
+inline isa detect_isa()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return isa::avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return isa::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return isa::sse2;
+    return isa::scalar;
+}
+#else
+inline isa detect_isa()     { return isa::scalar; }
+#endif
+
+// the best this machine can do, found out once
+inline isa native_isa()
+{
+    static const isa s_isa = detect_isa();
+    return s_isa;
+}
+
+template <typename T>
+inline constexpr bool is_kernel_type_v = std::is_arithmetic_v<T> && not std::is_same_v<T, bool>;
+
+namespace detail {
+
+template <typename T, size_t Bytes>
+struct vector {
+    typedef T type __attribute__((vector_size(Bytes)));
+    static constexpr size_t width = Bytes / sizeof(T);
+};
+
+// What sum and dot compute in: for integers, lanes of the unsigned type of the same size, and for the scalars the
+// unsigned type of what T promotes to, so that unsigned short * unsigned short does not become a signed int product
+// that may overflow. Floating point stays as it is.
+template <typename T, bool = std::is_integral_v<T>>
+struct wrapping {
+    using lane = T;
+    using scalar = T;
+};
+
+template <typename T>
+struct wrapping<T, true> {
+    using lane = std::make_unsigned_t<T>;
+    using scalar = std::make_unsigned_t<decltype(+T())>;
+};
+
+// unaligned: a Span may start anywhere
+template <typename V, typename T>
+[[gnu::always_inline]] inline V load(const T* _p)
+{
+    V v;
+    __builtin_memcpy(&v, _p, sizeof(V));
+    return v;
+}
+
+template <typename V, typename T>
+[[gnu::always_inline]] inline void store(T* _p, const V& _v)
+{
+    __builtin_memcpy(_p, &_v, sizeof(V));
+}
+
+// The kernels proper, for vectors of Bytes bytes. Always inlined, so that they are compiled for the instruction set
+// of the function that calls them, rather than for the one of the whole program.
+// Two accumulators, so that an addition does not have to wait for the one before it.
+
+template <size_t Bytes, typename T>
+[[gnu::always_inline]] inline T sum(const T* _p, size_t _n)
+{
+    using V = typename vector<typename wrapping<T>::lane, Bytes>::type;
+    using A = typename wrapping<T>::scalar;
+    constexpr size_t W = vector<T, Bytes>::width;
+
+    V acc0{}, acc1{};
+    size_t i = 0;
+    for (; i + 2 * W <= _n; i += 2 * W)
+    {
+        acc0 += load<V>(_p + i);
+        acc1 += load<V>(_p + i + W);
+    }
+    for (; i + W <= _n; i += W)
+        acc0 += load<V>(_p + i);
+    acc0 += acc1;
+
+    A result = 0;
+    for (size_t k = 0; k < W; ++k)
+        result += A(acc0[k]);
+    for (; i < _n; ++i)
+        result += A(_p[i]);
+    return T(result);
+}
+
+template <size_t Bytes, typename T>
+[[gnu::always_inline]] inline T dot(const T* _a, const T* _b, size_t _n)
+{
+    using V = typename vector<typename wrapping<T>::lane, Bytes>::type;
+    using A = typename wrapping<T>::scalar;
+    constexpr size_t W = vector<T, Bytes>::width;
+
+    V acc0{}, acc1{};
+    size_t i = 0;
+    for (; i + 2 * W <= _n; i += 2 * W)
+    {
+        acc0 += load<V>(_a + i) * load<V>(_b + i);
+        acc1 += load<V>(_a + i + W) * load<V>(_b + i + W);
+    }
+    for (; i + W <= _n; i += W)
+        acc0 += load<V>(_a + i) * load<V>(_b + i);
+    acc0 += acc1;
+
+    A result = 0;
+    for (size_t k = 0; k < W; ++k)
+        result += A(acc0[k]);
+    for (; i < _n; ++i)
+        result += A(_a[i]) * A(_b[i]);
+    return T(result);
+}
+
+// a select, not a branch, for scalars and vectors alike
+template <bool Max, typename A>
+[[gnu::always_inline]] inline A better(const A& a, const A& b)
+{
+    if constexpr (Max)
+        return a > b ? a : b;
+    else
+        return a < b ? a : b;
+}
+
+// min (Max = false) or max
+template <size_t Bytes, bool Max, typename T>
+[[gnu::always_inline]] inline T select(const T* _p, size_t _n)
+{
+    using V = typename vector<T, Bytes>::type;
+    constexpr size_t W = vector<T, Bytes>::width;
+
+    T result = _p[0];
+    size_t i = 0;
+    if (_n >= W)
+    {
+        V best0 = load<V>(_p), best1 = best0;
+        for (i = W; i + 2 * W <= _n; i += 2 * W)
+        {
+            best0 = better<Max>(load<V>(_p + i), best0);
+            best1 = better<Max>(load<V>(_p + i + W), best1);
+        }
+        for (; i + W <= _n; i += W)
+            best0 = better<Max>(load<V>(_p + i), best0);
+        best0 = better<Max>(best0, best1);
+
+        for (size_t k = 0; k < W; ++k)
+            result = better<Max>(T(best0[k]), result);
+    }
+    for (; i < _n; ++i)
+        result = better<Max>(_p[i], result);
+    return result;
+}
+
+template <size_t Bytes, typename T, typename F>
+[[gnu::always_inline]] inline void transform(const T* _in, T* _out, size_t _n, F& _f)
+{
+    using V = typename vector<T, Bytes>::type;
+    constexpr size_t W = vector<T, Bytes>::width;
+
+    size_t i = 0;
+    for (; i + W <= _n; i += W)
+        store<V>(_out + i, static_cast<V>(_f(load<V>(_in + i))));
+    for (; i < _n; ++i)
+        _out[i] = static_cast<T>(_f(_in[i]));
+}
+
+// the scalar versions, also what runs on other targets
+
+template <typename T>
+T sum_scalar(const T* _p, size_t _n)
+{
+    using A = typename wrapping<T>::scalar;
+    A result = 0;
+    for (size_t i = 0; i < _n; ++i)
+        result += A(_p[i]);
+    return T(result);
+}
+
+template <typename T>
+T dot_scalar(const T* _a, const T* _b, size_t _n)
+{
+    using A = typename wrapping<T>::scalar;
+    A result = 0;
+    for (size_t i = 0; i < _n; ++i)
+        result += A(_a[i]) * A(_b[i]);
+    return T(result);
+}
+
+template <bool Max, typename T>
+T select_scalar(const T* _p, size_t _n)
+{
+    T result = _p[0];
+    for (size_t i = 1; i < _n; ++i)
+        result = better<Max>(_p[i], result);
+    return result;
+}
+
+template <typename T>
+T min_scalar(const T* _p, size_t _n)                            { return select_scalar<false>(_p, _n); }
+
+template <typename T>
+T max_scalar(const T* _p, size_t _n)                            { return select_scalar<true>(_p, _n); }
+
+template <typename T, typename F>
+void transform_scalar(const T* _in, T* _out, size_t _n, F& _f)
+{
+    for (size_t i = 0; i < _n; ++i)
+        _out[i] = static_cast<T>(_f(_in[i]));
+}
+
+#ifdef SIMD_X86
+// one entry point per kernel and instruction set
+#define SIMD_KERNELS(suffix, isa_target, bytes)                                                                 \
+    template <typename T>                                                                                           \
+    [[gnu::target(isa_target)]] T sum_##suffix(const T* _p, size_t _n)                                              \
+    { return sum<bytes>(_p, _n); }                                                                                  \
+    template <typename T>                                                                                           \
+    [[gnu::target(isa_target)]] T dot_##suffix(const T* _a, const T* _b, size_t _n)                                 \
+    { return dot<bytes>(_a, _b, _n); }                                                                              \
+    template <typename T>                                                                                           \
+    [[gnu::target(isa_target)]] T min_##suffix(const T* _p, size_t _n)                                              \
+    { return select<bytes, false>(_p, _n); }                                                                        \
+    template <typename T>                                                                                           \
+    [[gnu::target(isa_target)]] T max_##suffix(const T* _p, size_t _n)                                              \
+    { return select<bytes, true>(_p, _n); }                                                                         \
+    template <typename T, typename F>                                                                               \
+    [[gnu::target(isa_target)]] void transform_##suffix(const T* _in, T* _out, size_t _n, F& _f)                    \
+    { transform<bytes>(_in, _out, _n, _f); }
+
+SIMD_KERNELS(sse2, "sse2", 16)
+SIMD_KERNELS(avx2, "avx2", 32)
+SIMD_KERNELS(avx512, "avx512f,avx512bw", 64)
+
+#undef SIMD_KERNELS
+
+#define SIMD_DISPATCH(_isa, kernel, ...)                                                                            \
+    switch (_isa)                                                                                                   \
+    {                                                                                                               \
+    case isa::avx512:   return detail::kernel##_avx512(__VA_ARGS__);                                                \
+    case isa::avx2:     return detail::kernel##_avx2(__VA_ARGS__);                                                  \
+    case isa::sse2:     return detail::kernel##_sse2(__VA_ARGS__);                                                  \
+    default:            return detail::kernel##_scalar(__VA_ARGS__);                                                \
+    }
+#else
+#define SIMD_DISPATCH(_isa, kernel, ...)                                                                            \
+    return detail::kernel##_scalar(__VA_ARGS__);
+#endif
+
+// a level this machine does not have would crash, so ask for too much and get what there is
+inline isa usable(isa _isa)
+{
+    return _isa < native_isa() ? _isa : native_isa();
+}
+
+} // namespace detail
+
+// The kernels. _isa picks the instruction set by hand (for comparisons); it is capped at native_isa().
+
+template <typename T>
+    requires is_kernel_type_v<T>
+T sum(const T* _p, size_t _n, isa _isa = native_isa())
+{
+    SIMD_DISPATCH(detail::usable(_isa), sum, _p, _n)
+}
+
+template <typename T>
+    requires is_kernel_type_v<T>
+T dot(const T* _a, const T* _b, size_t _n, isa _isa = native_isa())
+{
+    SIMD_DISPATCH(detail::usable(_isa), dot, _a, _b, _n)
+}
+
+template <typename T>
+    requires is_kernel_type_v<T>
+T min(const T* _p, size_t _n, isa _isa = native_isa())
+{
+    SIMD_DISPATCH(detail::usable(_isa), min, _p, _n)
+}
+
+template <typename T>
+    requires is_kernel_type_v<T>
+T max(const T* _p, size_t _n, isa _isa = native_isa())
+{
+    SIMD_DISPATCH(detail::usable(_isa), max, _p, _n)
+}
+
+template <typename T, typename F>
+    requires is_kernel_type_v<T>
+void transform(const T* _in, T* _out, size_t _n, F _f, isa _isa = native_isa())
+{
+    SIMD_DISPATCH(detail::usable(_isa), transform, _in, _out, _n, _f)
+}
+
+#undef SIMD_DISPATCH
+
+// the same over anything with data() and size(): Array, Span, std::vector...
+
+template <typename Range>
+auto sum(const Range& _r, isa _isa = native_isa()) -> decltype(simd::sum(_r.data(), _r.size(), _isa))
+{
+    return simd::sum(_r.data(), _r.size(), _isa);
+}
+
+template <typename Range>
+auto dot(const Range& _a, const Range& _b, isa _isa = native_isa()) -> decltype(simd::dot(_a.data(), _b.data(), _a.size(), _isa))
+{
+    return simd::dot(_a.data(), _b.data(), _a.size() < _b.size() ? _a.size() : _b.size(), _isa);
+}
+
+template <typename Range>
+auto min(const Range& _r, isa _isa = native_isa()) -> decltype(simd::min(_r.data(), _r.size(), _isa))
+{
+    return simd::min(_r.data(), _r.size(), _isa);
+}
+
+template <typename Range>
+auto max(const Range& _r, isa _isa = native_isa()) -> decltype(simd::max(_r.data(), _r.size(), _isa))
+{
+    return simd::max(_r.data(), _r.size(), _isa);
+}
+
+// out must have at least as many elements as in
+template <typename InRange, typename OutRange, typename F>
+auto transform(const InRange& _in, OutRange&& _out, F _f, isa _isa = native_isa())
+    -> decltype(simd::transform(_in.data(), _out.data(), _in.size(), _f, _isa))
+{
+    simd::transform(_in.data(), _out.data(), _in.size(), _f, _isa);
+}
+
+} // namespace simd
+
+#pragma GCC diagnostic pop
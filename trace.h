@@ -0,0 +1,79 @@
+// Lifecycle tracing for the classes under study: Int, S, A, T, and the copies and moves of the smart pointers.
+//
+// Their special members call Trace::record("what happened"), where they used to puts() it.
+// - null_trace::record() is empty, so the calls compile to nothing
+// - ring_trace::record() appends the event to a ring buffer of the calling thread: a pointer to the message
+//   (a string literal, used as a printf format) and one int for it, without formatting, locks or syscalls.
+//   dump() prints the events of the calling thread, oldest first, and empties the buffer. When more than ring_size
+//   events pile up in between, the oldest ones are overwritten. Whatever is left is printed when the thread exits.
+//
+// The classes default to default_trace, which the build picks: -DTRACE_LIFECYCLE=0 for null_trace, ring_trace otherwise.
+// The smart pointers of 210223 only do when they point to one of the classes under study (pointer_trace there), so that
+// the handles of the benchmarks record nothing.
+
+#pragma once
+
+#include <cstdio>
+
+struct null_trace {
+    static void record(const char*, int = 0) {}
+    static void dump() {}
+};
+
+class ring_trace
+{
+    struct event {
+        const char* format;
+        int value;
+    };
+
+    static constexpr unsigned ring_size = 1024; // a power of two
+
+    struct ring
+    {
+        ~ring()                 { dump(*this); }
+
+        event events[ring_size];
+        unsigned long long head = 0;    // events recorded so far
+        unsigned long long tail = 0;    // events dumped so far
+    };
+
+    static thread_local ring s_ring;
+
+public:
+    static void record(const char* _format, int _value = 0)
+    {
+        ring& r = s_ring;
+        r.events[r.head++ % ring_size] = {_format, _value};
+    }
+
+    static void dump()
+    {
+        dump(s_ring);
+    }
+
+private:
+    static void dump(ring& _ring)
+    {
+        if (_ring.head - _ring.tail > ring_size)
+        {
+            printf("(%llu events lost)\n", _ring.head - _ring.tail - ring_size);
+            _ring.tail = _ring.head - ring_size;
+        }
+
+        for (; _ring.tail != _ring.head; ++_ring.tail)
+        {
+            const event& e = _ring.events[_ring.tail % ring_size];
+            printf(e.format, e.value);
+            printf("\n");
+        }
+    }
+};
+
+inline thread_local ring_trace::ring ring_trace::s_ring;
+
+#if defined(TRACE_LIFECYCLE) && TRACE_LIFECYCLE == 0
+using default_trace = null_trace;
+#else
+using default_trace = ring_trace;
+#endif